@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <getopt.h>
+#include <string.h>
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+#include "estimator.h"
+#include "fixed_optimizer.h"
+#include "level_optimizer.h"
+#include "snapshot.h"
+
+//
+// Scaling benchmark for the estimator and the solvers on synthetic
+// estimate vectors. Prints one space separated row per measurement,
+// with NA where a column does not apply, so the output reads straight
+// into R like the 8nodes/64nodes tables.
+//
+
+static double now_ms()
+{
+  return std::chrono::duration<double, std::milli>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// small deterministic generator so runs are comparable across machines
+static unsigned int next_rand(unsigned int &state)
+{
+  state = state * 1664525u + 1013904223u;
+  return state >> 8;
+}
+
+static double uniform(unsigned int &state)
+{
+  return (next_rand(state) & 0xffffff) / double(0x1000000);
+}
+
+//
+// Estimate vectors shaped like the configs in conf_prediction:
+//  A - most nodes idle (~0.057), about one in six carrying 0.1-0.79
+//  B - every node busy, small spread (0.062-0.072)
+//  C - same shape as A with the heavy nodes at 0.08-0.36
+//  D - every node busy, small spread (0.065-0.073)
+//
+static std::vector<double> make_estimates(const char pattern, const int size)
+{
+  std::vector<double> estimates(size);
+  unsigned int state = 12345u + size;
+  for(int i = 0; i < size; ++i)
+  {
+    const double r = uniform(state);
+    switch(pattern)
+    {
+      case 'A':
+        estimates[i] = uniform(state) < 0.17 ? 0.1 + 0.69 * r : 0.0571 + 0.0001 * r;
+        break;
+      case 'B':
+        estimates[i] = 0.062 + 0.010 * r;
+        break;
+      case 'C':
+        estimates[i] = uniform(state) < 0.17 ? 0.08 + 0.28 * r : 0.0571 + 0.0001 * r;
+        break;
+      default:
+        estimates[i] = 0.065 + 0.008 * r;
+        break;
+    }
+  }
+  return estimates;
+}
+
+static void print_row(const char *bench,
+                      const int nodes,
+                      const char pattern,
+                      const double cap,
+                      const double inc,
+                      const char *solver,
+                      const double wall_ms,
+                      const long long calls,
+                      const long long rounds,
+                      const double old_time,
+                      const double runtime)
+{
+  std::cout<<bench<<" "<<nodes<<" "<<pattern<<" ";
+  if(cap > 0) std::cout<<cap; else std::cout<<"NA";
+  std::cout<<" ";
+  if(inc > 0) std::cout<<inc; else std::cout<<"NA";
+  std::cout<<" "<<solver<<" "<<std::setprecision(6)<<wall_ms<<" ";
+  if(calls >= 0) std::cout<<calls; else std::cout<<"NA";
+  std::cout<<" ";
+  if(rounds >= 0)
+  {
+    std::cout<<rounds<<" "<<(wall_ms > 0 ? rounds / (wall_ms / 1000.0) : 0);
+  }
+  else
+  {
+    std::cout<<"NA NA";
+  }
+  std::cout<<" ";
+  if(runtime > 0) std::cout<<old_time<<" "<<runtime; else std::cout<<"NA NA";
+  std::cout<<"\n"<<std::flush;
+}
+
+//
+// Repeated small solves, the generic greedy against the compile time
+// kernel of fixed_optimizer.h. calls is the number of solves.
+//
+template<int N>
+static void bench_fixed(Estimator &estimator,
+                        const char pattern,
+                        const std::vector<double> &caps,
+                        const std::vector<double> &incs)
+{
+  const int repeats = 1000;
+  std::vector<double> estimates = make_estimates(pattern, N);
+  PowerOptimizer optimizer(estimator, estimates, false);
+  optimizer.set_quiet(true);
+  FixedOptimizer<N, PP_DEFAULT_CURVE_SIZE> fixed(PP_DEFAULT_ESTIMATOR, &estimates[0]);
+  for(size_t c = 0; c < caps.size(); ++c)
+  {
+    for(size_t i = 0; i < incs.size(); ++i)
+    {
+      double sink = 0;
+      long long rounds = 0;
+      double start = now_ms();
+      for(int r = 0; r < repeats; ++r)
+      {
+        PowerAllocation res = optimizer.optimize(caps[c], incs[i], false);
+        sink += res.get_max_runtime();
+        rounds += res.m_stats.m_rounds;
+      }
+      print_row("repeat", N, pattern, caps[c], incs[i], "greedy", now_ms() - start,
+                repeats, rounds, 0, 0);
+
+      rounds = 0;
+      start = now_ms();
+      for(int r = 0; r < repeats; ++r)
+      {
+        FixedAllocation<N, PP_DEFAULT_CURVE_SIZE> res(PP_DEFAULT_ESTIMATOR, &estimates[0], caps[c]);
+        rounds += fixed.greedy_rounds(res, incs[i]);
+        sink += res.get_max_runtime();
+      }
+      print_row("repeat", N, pattern, caps[c], incs[i], "fixed", now_ms() - start,
+                repeats, rounds, 0, 0);
+      if(sink == 42) std::cout<<"";
+    }
+  }
+}
+
+//
+// Stress test of AllocationPublisher. The writer publishes in a tight
+// loop, every cap of version v set to v, while reader threads pin the
+// current snapshot over and over. A pinned snapshot must be uniform
+// and carry its own version, and a reader must never see the version
+// go backwards; any failure is reported and fails the run. calls is
+// the number of pinned reads, rounds the number of versions published.
+//
+static bool bench_publish(const char pattern, const int nodes)
+{
+  const int readers = 4;
+  const int publishes = 2000;
+  AllocationPublisher published;
+  std::atomic<bool> done(false);
+  std::atomic<long long> reads(0);
+  std::atomic<long long> torn(0);
+  std::atomic<long long> backwards(0);
+
+  std::vector<std::thread> threads;
+  for(int r = 0; r < readers; ++r)
+  {
+    threads.push_back(std::thread([&]()
+    {
+      long long count = 0;
+      uint64_t last = 0;
+      while(!done.load())
+      {
+        const PinnedAllocation pinned(published);
+        const uint64_t version = pinned.version();
+        if(version == 0) continue;
+        if(version < last) backwards++;
+        last = version;
+        const double expected = static_cast<double>(version);
+        bool uniform = pinned.size() == static_cast<size_t>(nodes);
+        for(size_t i = 0; i < pinned.size() && uniform; ++i)
+        {
+          // let the writer come round a few times while the snapshot
+          // is still pinned, even on a single core
+          if(i % (pinned.size() / 4 + 1) == 0) std::this_thread::yield();
+          uniform = pinned.cap(static_cast<int>(i)) == expected;
+        }
+        if(!uniform) torn++;
+        count++;
+      }
+      reads += count;
+    }));
+  }
+
+  std::vector<double> power(nodes);
+  const double start = now_ms();
+  for(int k = 0; k < publishes; ++k)
+  {
+    std::fill(power.begin(), power.end(), static_cast<double>(published.get_last_version() + 1));
+    published.publish(&power[0], power.size(), 0);
+    std::this_thread::yield();
+  }
+  const double wall = now_ms() - start;
+  done = true;
+  for(size_t t = 0; t < threads.size(); ++t)
+  {
+    threads[t].join();
+  }
+  if(torn.load() != 0 || backwards.load() != 0)
+  {
+    std::cerr<<"Error: "<<torn.load()<<" torn snapshots, "<<backwards.load()<<" versions went backwards\n";
+  }
+  print_row("publish", nodes, pattern, 0, 0, "snapshot", wall, reads.load(),
+            static_cast<long long>(published.get_last_version()), 0, 0);
+  return torn.load() == 0 && backwards.load() == 0;
+}
+
+static std::vector<double> parse_list(const char *list)
+{
+  std::vector<double> values;
+  std::stringstream str(list);
+  std::string item;
+  while(std::getline(str, item, ','))
+  {
+    if(!item.empty()) values.push_back(atof(item.c_str()));
+  }
+  return values;
+}
+
+int main(int argc, char** argv)
+{
+  const char *usage = "\n"
+                      "NAME\n"
+                      "  bench - Scaling benchmark for the power optimizer.\n"
+                      "SYNOPSIS\n"
+                      "  %s [-m max_nodes] [-M max_solve_nodes] [-s caps] [-i incs] [-c patterns]\n"
+                      "OPTIONS\n"
+                      "  -m max_nodes\n"
+                      "     Largest vector for the estimate/allocation benchmarks (default 1048576).\n"
+                      "  -M max_solve_nodes\n"
+                      "     Largest vector for full solves (default 262144).\n"
+                      "  -s cap1,cap2,...\n"
+                      "     Power caps to solve at (default 100,80,65).\n"
+                      "  -i inc1,inc2,...\n"
+                      "     Greedy increments (default 1,0.1).\n"
+                      "  -c patterns\n"
+                      "     Estimate patterns, any of ABCD (default ABCD).\n"
+                      "\n";
+  int max_nodes = 1 << 20;
+  int max_solve_nodes = 1 << 18;
+  std::vector<double> caps = parse_list("100,80,65");
+  std::vector<double> incs = parse_list("1,0.1");
+  std::string patterns = "ABCD";
+  int opt;
+  while((opt = getopt(argc, argv, "hm:M:s:i:c:")) != -1)
+  {
+    switch(opt)
+    {
+      case 'm':
+        max_nodes = atoi(optarg);
+        break;
+      case 'M':
+        max_solve_nodes = atoi(optarg);
+        break;
+      case 's':
+        caps = parse_list(optarg);
+        break;
+      case 'i':
+        incs = parse_list(optarg);
+        break;
+      case 'c':
+        patterns = optarg;
+        break;
+      case 'h':
+        printf(usage, argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        printf(usage, argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  Estimator estimator(PP_DEFAULT_TIMES, PP_DEFAULT_POWER, PP_DEFAULT_CURVE_SIZE, false);
+
+  std::cout<<"bench nodes pattern cap inc solver wall_ms calls rounds rounds_per_sec old_time runtime\n";
+  // false once a stress test failed
+  bool ok = true;
+
+  for(size_t p = 0; p < patterns.size(); ++p)
+  {
+    const char pattern = patterns[p];
+    bench_fixed<8>(estimator, pattern, caps, incs);
+    bench_fixed<64>(estimator, pattern, caps, incs);
+    ok = bench_publish(pattern, 4096) && ok;
+
+    std::vector<int> sizes;
+    for(int nodes = 8; nodes < max_nodes; nodes *= 8)
+    {
+      sizes.push_back(nodes);
+    }
+    sizes.push_back(max_nodes);
+    for(size_t n = 0; n < sizes.size(); ++n)
+    {
+      const int nodes = sizes[n];
+      std::vector<double> estimates = make_estimates(pattern, nodes);
+      std::vector<double> power_values(nodes);
+      unsigned int state = 7u;
+      for(int i = 0; i < nodes; ++i)
+      {
+        power_values[i] = 64 + 51 * uniform(state);
+      }
+      std::vector<double> out(nodes);
+
+      // scalar estimate
+      double sink = 0;
+      double start = now_ms();
+      for(int i = 0; i < nodes; ++i)
+      {
+        sink += estimator.estimate(power_values[i], estimates[i]);
+      }
+      print_row("estimate", nodes, pattern, 0, 0, "scalar", now_ms() - start, nodes, -1, 0, 0);
+
+      // batched estimate
+      start = now_ms();
+      estimator.estimate(&power_values[0], &estimates[0], &out[0], nodes);
+      print_row("estimate", nodes, pattern, 0, 0, "batch", now_ms() - start, nodes, -1, 0, 0);
+      sink += out[nodes - 1];
+
+      // allocation construction and candidate checks
+      start = now_ms();
+      PowerAllocation alloc(nodes, 80, &estimates, &estimator);
+      print_row("allocation", nodes, pattern, 80, 0, "NA", now_ms() - start, nodes, -1, 0, 0);
+
+      const int checks = std::min(nodes - 1, 100000);
+      start = now_ms();
+      for(int i = 0; i < checks; ++i)
+      {
+        Adjustment adj;
+        adj.to = alloc.get_max_index();
+        adj.from = adj.to == i ? nodes - 1 : i;
+        adj.amount = 1;
+        sink += alloc.check_adjustment(adj, false);
+      }
+      print_row("check_adjustment", nodes, pattern, 80, 1, "NA", now_ms() - start, checks, -1, 0, 0);
+      if(sink == 42) std::cout<<"";
+
+      if(nodes > max_solve_nodes) continue;
+
+      PowerOptimizer optimizer(estimator, estimates, false);
+      optimizer.set_quiet(true);
+      const char *names[3] = {"greedy", "adaptive", "water"};
+      const SolverType solvers[3] = {GREEDY, ADAPTIVE, WATER_FILL};
+      for(size_t c = 0; c < caps.size(); ++c)
+      {
+        for(size_t i = 0; i < incs.size(); ++i)
+        {
+          for(int s = 0; s < 3; ++s)
+          {
+            // water filling does not use the increment
+            if(solvers[s] == WATER_FILL && i > 0) continue;
+            start = now_ms();
+            PowerAllocation res = optimizer.solve(solvers[s], caps[c], incs[i], false);
+            const double wall = now_ms() - start;
+            print_row("optimize", nodes, pattern, caps[c],
+                      solvers[s] == WATER_FILL ? 0 : incs[i],
+                      names[s], wall, -1, res.m_stats.m_rounds,
+                      res.m_initial_runtime, res.get_max_runtime());
+          }
+
+          // the greedy on level tables, table build included
+          start = now_ms();
+          const std::vector<int> no_curves;
+          const LevelOptimizer levels(estimator, EstimateView(estimates), no_curves, caps[c], incs[i]);
+          LevelAllocation res(levels.get_table(), EstimateView(estimates), no_curves);
+          const int rounds = levels.greedy_rounds(res);
+          const double wall = now_ms() - start;
+          print_row("optimize", nodes, pattern, caps[c], incs[i], "levels", wall, -1, rounds,
+                    res.m_initial_runtime, res.get_max_runtime());
+        }
+      }
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
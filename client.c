@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+//
+// Test client for the server mode of prog (-S socket_path). Sends
+// request lines and prints one reply line per request. With -r the
+// given requests are sent in turn count times and only the latency
+// is printed.
+//
+
+static double now_us()
+{
+  return std::chrono::duration<double, std::micro>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// send one request and read its reply line, false if the server is gone
+static bool request(FILE *out, FILE *in, const std::string &line, char *&reply, size_t &capacity)
+{
+  fwrite(line.data(), 1, line.size(), out);
+  fputc('\n', out);
+  fflush(out);
+  return getline(&reply, &capacity, in) != -1;
+}
+
+int main(int argc, char** argv)
+{
+  const char *usage = "\n"
+                      "NAME\n"
+                      "  client - Send requests to a power_play server.\n"
+                      "SYNOPSIS\n"
+                      "  %s -s socket_path [-r request]... [-b count]\n"
+                      "OPTIONS\n"
+                      "  -s socket_path\n"
+                      "     Unix domain socket the server listens on.\n"
+                      "  -r request\n"
+                      "     Request to send instead of reading lines from stdin, repeatable.\n"
+                      "  -b count\n"
+                      "     Send the -r requests in turn count times and print the mean\n"
+                      "     and max round trip in microseconds instead of the replies.\n"
+                      "\n";
+  const char *path = NULL;
+  std::vector<std::string> requests;
+  int count = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "hs:r:b:")) != -1)
+  {
+    switch(opt)
+    {
+      case 's':
+        path = optarg;
+        break;
+      case 'r':
+        requests.push_back(optarg);
+        break;
+      case 'b':
+        count = atoi(optarg);
+        break;
+      case 'h':
+        printf(usage, argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        printf(usage, argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if(path == NULL || (count > 0 && requests.empty()))
+  {
+    printf(usage, argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  if(fd == -1 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+  {
+    fprintf(stderr, "Error: cannot connect to %s\n", path);
+    return EXIT_FAILURE;
+  }
+  FILE *in = fdopen(fd, "r");
+  FILE *out = fdopen(dup(fd), "w");
+
+  char *reply = NULL;
+  size_t capacity = 0;
+  if(count > 0)
+  {
+    double total = 0;
+    double worst = 0;
+    for(int i = 0; i < count; ++i)
+    {
+      const double start = now_us();
+      if(!request(out, in, requests[i % requests.size()], reply, capacity))
+      {
+        fprintf(stderr, "Error: server closed the connection\n");
+        return EXIT_FAILURE;
+      }
+      const double elapsed = now_us() - start;
+      total += elapsed;
+      worst = elapsed > worst ? elapsed : worst;
+    }
+    printf("requests %d mean_us %.3f max_us %.3f\n", count, total / count, worst);
+  }
+  else if(!requests.empty())
+  {
+    for(size_t i = 0; i < requests.size(); ++i)
+    {
+      if(!request(out, in, requests[i], reply, capacity)) break;
+      fputs(reply, stdout);
+    }
+  }
+  else
+  {
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while((length = getline(&line, &line_capacity, stdin)) != -1)
+    {
+      if(length > 0 && line[length - 1] == '\n') line[length - 1] = '\0';
+      if(!request(out, in, line, reply, capacity)) break;
+      fputs(reply, stdout);
+    }
+    free(line);
+  }
+  free(reply);
+  fclose(in);
+  fclose(out);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,174 @@
+#ifndef energy_h
+#define energy_h
+
+#include <vector>
+#include <limits>
+#include <iostream>
+#include <iomanip>
+#include <stdio.h>
+
+#include "estimator.h"
+
+//
+// Energy to solution: every node draws its cap until the slowest one
+// is done, so a plan costs sum(power) * max runtime. The min-runtime
+// solvers hand out the whole budget, including watts that buy nothing
+// (nodes far below the bottleneck, or the flat top of the curve).
+//
+// For a target runtime T the cheapest plan gives every node the least
+// power that meets T (Estimator::min_power_for_time), so the energy is
+// at most T * sum_i min_power_i(T). The sum only falls as T grows but the
+// product need not be monotone, so T is scanned from the min-runtime
+// plan's runtime up to the allowed slowdown and refined around the
+// best point. Power not needed by the chosen plan is left unassigned
+// and reported as releasable.
+//
+class EnergyOptimizer
+{
+protected:
+  PowerOptimizer &m_optimizer;
+  double m_budget;
+  double m_fast_energy;
+  double m_energy;
+  double m_released;
+
+  //
+  // Least power per node for a runtime of target, at most the node's
+  // power in the min-runtime plan fast_power. The inverse answers
+  // against the monotone envelope of the curve, so a node the raw
+  // curve leaves slower than target keeps its fast_power.
+  //
+  static void plan_for(PowerAllocation &allocation,
+                       const double target,
+                       const std::vector<double> &fast_power,
+                       std::vector<double> &power)
+  {
+    const int size = static_cast<int>(allocation.m_power_values.size());
+    power.resize(size);
+    PP_STAT(allocation.m_stats.m_inverse_calls += size);
+    for(int i = 0; i < size; ++i)
+    {
+      power[i] = allocation.m_estimator->min_power_for_time(allocation.m_orig_estimates[i], target,
+                                                            allocation.get_curve(i));
+      if(!(power[i] < fast_power[i]) || allocation.estimate(i, power[i]) > target)
+      {
+        power[i] = fast_power[i];
+      }
+    }
+    allocation.set_power(power);
+  }
+
+  static double energy_of(const PowerAllocation &allocation)
+  {
+    return allocation.get_total_power() * allocation.get_max_runtime();
+  }
+
+public:
+  explicit EnergyOptimizer(PowerOptimizer &optimizer)
+    : m_optimizer(optimizer),
+      m_budget(0),
+      m_fast_energy(0),
+      m_energy(0),
+      m_released(0)
+  {
+  }
+
+  //
+  // Lowest energy plan no slower than max_slowdown (0.05 for 5%)
+  // above what solver reaches at this budget. 0 keeps the runtime and
+  // only gives back the watts that don't help.
+  //
+  PowerAllocation optimize(SolverType solver,
+                           double ave_power_per_node,
+                           double power_inc,
+                           double max_slowdown,
+                           bool verbose,
+                           const int points = 64)
+  {
+    PowerAllocation allocation = m_optimizer.solve(solver, ave_power_per_node, power_inc, false);
+    // the budget, which water filling need not spend in full
+    m_budget = m_optimizer.get_budget(ave_power_per_node);
+    m_fast_energy = energy_of(allocation);
+    const std::vector<double> fast_power = allocation.m_power_values;
+    const double fast_time = allocation.get_max_runtime();
+    const double slow_time = fast_time * (1 + max_slowdown);
+
+    std::vector<double> power;
+    std::vector<double> best_power = fast_power;
+    double best_energy = m_fast_energy;
+    double best_time = fast_time;
+    double step = points > 0 ? (slow_time - fast_time) / points : 0;
+    PP_PHASE(allocation.m_stats, m_search_ms);
+    // coarse scan, then the same number of points around the best
+    for(int pass = 0; pass < 2; ++pass)
+    {
+      const double lo = pass == 0 ? fast_time : std::max(fast_time, best_time - step);
+      const double hi = pass == 0 ? slow_time : std::min(slow_time, best_time + step);
+      if(pass == 1)
+      {
+        step = (hi - lo) / points;
+      }
+      for(int k = 0; k <= points; ++k)
+      {
+        const double target = k == points ? hi : lo + k * step;
+        allocation.m_stats.m_rounds++;
+        plan_for(allocation, target, fast_power, power);
+        const double energy = energy_of(allocation);
+        if(verbose == true)
+        {
+          std::cout<<"---- Target "<<std::setprecision(8)<<target<<" ---- power "
+                   <<allocation.get_total_power()<<" energy "<<energy<<"\n";
+        }
+        if(energy < best_energy)
+        {
+          best_energy = energy;
+          best_time = target;
+          best_power = power;
+        }
+      }
+      if(step <= 0)
+      {
+        break;
+      }
+    }
+
+    allocation.set_power(best_power);
+    m_energy = energy_of(allocation);
+    m_released = m_budget - allocation.get_total_power();
+    return allocation;
+  }
+
+  double get_budget() const
+  {
+    return m_budget;
+  }
+
+  // energy of the min-runtime plan
+  double get_fast_energy() const
+  {
+    return m_fast_energy;
+  }
+
+  double get_energy() const
+  {
+    return m_energy;
+  }
+
+  // watts of the budget the plan leaves for other jobs
+  double get_released_power() const
+  {
+    return m_released;
+  }
+}; // class EnergyOptimizer
+
+// two lines after the table or summary
+inline void print_energy(std::ostream &out, const EnergyOptimizer &energy)
+{
+  char line[160];
+  const int len = snprintf(line, sizeof(line), "Energy: %.5g -> %.5g\nReleased: %.5g of %.5g W\n",
+                           energy.get_fast_energy(), energy.get_energy(),
+                           energy.get_released_power(), energy.get_budget());
+  out.write(line, len);
+}
+
+#endif
@@ -7,95 +7,588 @@
 #include <iostream>
 #include <stdlib.h>
 #include <iomanip>
+#include <limits>
+#include <functional>
+#include <cmath>
+#include <string>
+#include <stdio.h>
+#include <memory>
+#include <stdint.h>
+
+#include "tournament_tree.h"
+#include "stats.h"
+
+//
+// Read only view of estimates owned by someone else, e.g. a vector or
+// the mmap'ed binary file of an EstimateSource. Nothing is copied;
+// the owner has to outlive every view of it.
+//
+class EstimateView
+{
+protected:
+  const double *m_data;
+  size_t m_size;
+public:
+  EstimateView()
+    : m_data(NULL),
+      m_size(0)
+  {
+  }
+
+  EstimateView(const double *data, const size_t size)
+    : m_data(data),
+      m_size(size)
+  {
+  }
+
+  EstimateView(const std::vector<double> &values)
+    : m_data(values.empty() ? NULL : &values[0]),
+      m_size(values.size())
+  {
+  }
+
+  const double* data() const
+  {
+    return m_data;
+  }
+
+  size_t size() const
+  {
+    return m_size;
+  }
+
+  bool empty() const
+  {
+    return m_size == 0;
+  }
+
+  double operator[](const size_t i) const
+  {
+    return m_data[i];
+  }
+
+  const double* begin() const
+  {
+    return m_data;
+  }
+
+  const double* end() const
+  {
+    return m_data + m_size;
+  }
+}; // class EstimateView
+
+// one measured (power cap, runtime) point, runtime in curve units
+struct CurveSample
+{
+  double m_power;
+  double m_time;
+};
 
 class Estimator
 {
 protected:    
-    double m_percent_change;
+    //
+    // Every curve class is stored back to back in the same arrays
+    // (structure of arrays), class k owning the entries
+    // [m_curve_start[k], m_curve_start[k] + m_curve_size[k]).
+    // Class 0 is the curve given to the constructor.
+    //
     std::vector<double> m_times;
     std::vector<double> m_power;
+    // un-normalized times and how many samples each knot stands for,
+    // the measured curve counting as one (see add_samples)
+    std::vector<double> m_raw_times;
+    std::vector<double> m_weights;
+    // m_fastest[i] is the lowest normalized time reachable with at
+    // most m_power[i] watts, i.e. the curve made monotone
+    std::vector<double> m_fastest;
+    std::vector<int> m_curve_start;
+    std::vector<int> m_curve_size;
+    std::vector<double> m_percent_change;
+    // > 0 when a curve is evenly spaced so segments can be found
+    // by division instead of a search
+    std::vector<double> m_power_step;
     bool m_is_verbose;
+
+    void init_segment_index(const int curve)
+    {
+      const double *power = &m_power[m_curve_start[curve]];
+      const int size = m_curve_size[curve];
+      m_power_step[curve] = 0;
+      if(size < 2) return;
+      const double step = (power[0] - power[size - 1]) / (size - 1);
+      for(int i = 1; i < size; ++i)
+      {
+        if(std::abs((power[i - 1] - power[i]) - step) > 1e-9 * step)
+        {
+          return;
+        }
+      }
+      m_power_step[curve] = step;
+    }
+
+    void init_fastest(const int curve)
+    {
+      const int start = m_curve_start[curve];
+      const int end = start + m_curve_size[curve];
+      m_fastest[end - 1] = m_times[end - 1];
+      for(int i = end - 2; i >= start; --i)
+      {
+        m_fastest[i] = std::min(m_times[i], m_fastest[i + 1]);
+      }
+    }
+
+    // m_times, m_percent_change and m_fastest from m_raw_times
+    void normalize(const int curve)
+    {
+      const int start = m_curve_start[curve];
+      const int size = m_curve_size[curve];
+      double max_val = -1;
+      double min_val = 1e30;
+      for(int i = start; i < start + size; ++i)
+      {
+        max_val = std::max(max_val, m_raw_times[i]);
+        min_val = std::min(min_val, m_raw_times[i]);
+      }
+      for(int i = start; i < start + size; ++i)
+      {
+        m_times[i] = (m_raw_times[i] - min_val) / (max_val - min_val);
+      }
+      m_percent_change[curve] = (max_val - min_val) / max_val;
+      init_fastest(curve);
+    }
+
+    //
+    // Index (into the shared arrays) of the higher power end of the
+    // curve segment that contains power_value. The lower end is the
+    // next index.
+    //
+    int find_segment(const int curve, const double power_value) const
+    {
+      const int start = m_curve_start[curve];
+      const double *power = &m_power[start];
+      const int last = m_curve_size[curve] - 2;
+      const double step = m_power_step[curve];
+      int seg;
+      if(step > 0)
+      {
+        seg = static_cast<int>((power[0] - power_value) / step);
+        seg = std::max(0, std::min(seg, last));
+        // the division can land one off next to a knot
+        while(seg < last && power[seg + 1] >= power_value) seg++;
+        while(seg > 0 && power[seg] < power_value) seg--;
+      }
+      else
+      {
+        // power is descending, find the first entry below the value
+        const double *it = std::upper_bound(power, power + last + 2, power_value, std::greater<double>());
+        seg = static_cast<int>(it - power) - 1;
+        seg = std::max(0, std::min(seg, last));
+      }
+      return start + seg;
+    }
+
+    double interpolate_normalized(const int max_index, const double power_value) const
+    {
+      const int min_index = max_index + 1;
+      double delta = (power_value - m_power[min_index])/(m_power[max_index] - m_power[min_index]);
+      return m_times[min_index] + delta * (m_times[max_index] - m_times[min_index]);
+    }
+
+    double interpolate(const int curve,
+                       const int max_index,
+                       const double power_value,
+                       const double orig_estimate) const
+    {
+      double normalized_time = interpolate_normalized(max_index, power_value);
+      double diff = orig_estimate * (1.0 + m_percent_change[curve]) - orig_estimate;
+      return orig_estimate + normalized_time * diff;
+    }
 public:
     // Give me un-normalized times with 
     // times[0] being the fastest and times[n-1] slowest
     // power[0] highest and power[n-1] lowest
     Estimator(const double *times, const double *power, const int array_size, bool verbose)
     {
+      m_is_verbose = verbose;
+      add_curve(times, power, array_size);
+    }
+
+    //
+    // Add another curve class, same layout as the constructor.
+    // Returns the class id nodes use to refer to it.
+    //
+    int add_curve(const double *times, const double *power, const int array_size)
+    {
+      assert(array_size > 1);
       assert(times[0] <= times[array_size - 1]);
       assert(power[0] >= power[array_size - 1]);
-      assert(array_size > 0);
-
-      m_power.resize(array_size);
-      m_times.resize(array_size);
 
-      m_is_verbose = verbose;
+      const int curve = static_cast<int>(m_curve_start.size());
+      const int start = static_cast<int>(m_power.size());
+      m_curve_start.push_back(start);
+      m_curve_size.push_back(array_size);
+      m_percent_change.push_back(0);
+      m_power_step.push_back(0);
+      m_power.resize(start + array_size);
+      m_times.resize(start + array_size);
+      m_fastest.resize(start + array_size);
+      m_raw_times.resize(start + array_size);
+      m_weights.resize(start + array_size, 1.0);
 
-      double max_val = -1;
-      double min_val = 1e30;
-      //
-      // normalize the time values
-      //
       for(int i = 0; i < array_size; ++i)
       {
-        max_val = std::max(max_val, times[i]);
-        min_val = std::min(min_val, times[i]);
+        m_raw_times[start + i] = times[i];
+        m_power[start + i] = power[i];
       }
+      init_segment_index(curve);
+      normalize(curve);
+      return curve;
+    }
 
-      for(int i = 0; i < array_size; ++i)
+    //
+    // Refine a curve with measured (power cap, runtime) samples, runtimes
+    // in the units of the times the curve was built from. Each sample
+    // is split between the two knots around its power by linear
+    // interpolation weight and folded into their running means, then
+    // the curve is normalized again: O(count + curve size). Samples
+    // outside the curve's power range are ignored; returns how many
+    // were used. Optimizers see the change on their next solve, an
+    // existing allocation after update_times().
+    //
+    // Returns -1 and keeps the curve as it was if a runtime is not
+    // finite and positive, or if the refined times would all be equal
+    // and the curve could not be normalized.
+    //
+    int add_samples(const CurveSample *samples, const int count, const int curve = 0)
+    {
+      for(int s = 0; s < count; ++s)
       {
-        m_times[i] = (times[i]-min_val) / (max_val - min_val);
-        m_power[i] = power[i];
+        if(!std::isfinite(samples[s].m_time) || samples[s].m_time <= 0)
+        {
+          return -1;
+        }
       }
-      
-      m_percent_change = (max_val - min_val) / max_val;
+      const int start = m_curve_start[curve];
+      const int end = start + m_curve_size[curve];
+      const std::vector<double> old_times(m_raw_times.begin() + start, m_raw_times.begin() + end);
+      const std::vector<double> old_weights(m_weights.begin() + start, m_weights.begin() + end);
+      int used = 0;
+      for(int s = 0; s < count; ++s)
+      {
+        const double p = samples[s].m_power;
+        if(!(p <= get_max_power(curve) && p >= get_min_power(curve)))
+        {
+          continue;
+        }
+        const int hi = find_segment(curve, p);
+        const int lo = hi + 1;
+        const double delta = (p - m_power[lo]) / (m_power[hi] - m_power[lo]);
+        const int knots[2] = {hi, lo};
+        const double shares[2] = {delta, 1.0 - delta};
+        for(int k = 0; k < 2; ++k)
+        {
+          if(shares[k] <= 0) continue;
+          const int i = knots[k];
+          m_raw_times[i] += (samples[s].m_time - m_raw_times[i]) * shares[k] / (m_weights[i] + shares[k]);
+          m_weights[i] += shares[k];
+        }
+        used++;
+      }
+      if(used == 0)
+      {
+        return 0;
+      }
+      const double max_val = *std::max_element(m_raw_times.begin() + start, m_raw_times.begin() + end);
+      const double min_val = *std::min_element(m_raw_times.begin() + start, m_raw_times.begin() + end);
+      if(!(max_val > min_val))
+      {
+        std::copy(old_times.begin(), old_times.end(), m_raw_times.begin() + start);
+        std::copy(old_weights.begin(), old_weights.end(), m_weights.begin() + start);
+        return -1;
+      }
+      normalize(curve);
+      return used;
+    }
+
+    // un-normalized time of knot i of a curve, as refined so far
+    double get_curve_time(const int i, const int curve = 0) const
+    {
+      return m_raw_times[m_curve_start[curve] + i];
+    }
+
+    double get_curve_power(const int i, const int curve = 0) const
+    {
+      return m_power[m_curve_start[curve] + i];
+    }
+
+    int get_curve_size(const int curve = 0) const
+    {
+      return m_curve_size[curve];
+    }
+
+    int get_num_curves() const
+    {
+      return static_cast<int>(m_curve_start.size());
+    }
+
+    //
+    // estimate() in two parts: with diff = orig * get_time_scale(curve)
+    // - orig, the time is orig + get_normalized_time(power, curve) *
+    // diff, bit for bit.
+    //
+    double get_normalized_time(const double power_value, const int curve = 0) const
+    {
+      assert(power_value <= get_max_power(curve) && 
+             power_value >= get_min_power(curve));
+      return interpolate_normalized(find_segment(curve, power_value), power_value);
+    }
+
+    double get_time_scale(const int curve = 0) const
+    {
+      return 1.0 + m_percent_change[curve];
+    }
+
+    //
+    // Lowest time any power gets a node with the given original
+    // estimate down to. On a curve that is slower at the top than
+    // somewhere below it, that is not the time at max power.
+    //
+    double get_fastest_time(double orig_estimate, const int curve = 0) const
+    {
+      const double diff = orig_estimate * (1.0 + m_percent_change[curve]) - orig_estimate;
+      if(diff <= 0)
+      {
+        return orig_estimate;
+      }
+      return orig_estimate + m_fastest[m_curve_start[curve]] * diff;
+    }
+
+    double get_max_power(const int curve = 0) const
+    {
+      return m_power[m_curve_start[curve]];
+    }
+
+    //
+    // The level the even split clamps every node to: a node gets
+    // max(min, min(max, level)) of its own curve. That is
+    // ave_power_per_node unless the nodes raised to their min power
+    // would spend more than size * ave_power_per_node; then the level
+    // drops until the budget is met, so the surplus comes from the
+    // nodes that have room. The budget must cover every node's min
+    // power. curves is NULL when every node uses class 0.
+    //
+    double get_even_split_level(const double ave_power_per_node, const int *curves, const int size) const
+    {
+      const int num_curves = get_num_curves();
+      std::vector<int> counts(num_curves, 0);
+      for(int i = 0; i < size; ++i)
+      {
+        counts[curves == NULL ? 0 : curves[i]]++;
+      }
+      const double budget = size * ave_power_per_node;
+      std::vector<double> kinks;
+      double spent_at_ave = 0;
+      for(int k = 0; k < num_curves; ++k)
+      {
+        if(counts[k] == 0) continue;
+        spent_at_ave += counts[k] * std::max(get_min_power(k), std::min(get_max_power(k), ave_power_per_node));
+        if(get_min_power(k) < ave_power_per_node) kinks.push_back(get_min_power(k));
+        if(get_max_power(k) < ave_power_per_node) kinks.push_back(get_max_power(k));
+      }
+      if(spent_at_ave <= budget)
+      {
+        return ave_power_per_node;
+      }
+      // the power spent is piecewise linear in the level, with kinks at
+      // the curves' min and max power: find the piece that meets budget
+      std::sort(kinks.begin(), kinks.end(), std::greater<double>());
+      double hi = ave_power_per_node;
+      double spent_hi = spent_at_ave;
+      for(size_t j = 0; j < kinks.size(); ++j)
+      {
+        const double lo = kinks[j];
+        double spent_lo = 0;
+        for(int k = 0; k < num_curves; ++k)
+        {
+          spent_lo += counts[k] * std::max(get_min_power(k), std::min(get_max_power(k), lo));
+        }
+        if(spent_lo <= budget)
+        {
+          return lo + (budget - spent_lo) * (hi - lo) / (spent_hi - spent_lo);
+        }
+        hi = lo;
+        spent_hi = spent_lo;
+      }
+      // not enough for the min powers, every node at its min
+      return hi;
     }
 
-    double get_max_power() const
+    double get_min_power(const int curve = 0) const
     {
-      return m_power[0];
+      return m_power[m_curve_start[curve] + m_curve_size[curve] - 1];
     }
 
-    double get_min_power() const
+    // widest power range over all curves
+    double get_max_power_range() const
     {
-      const int size = static_cast<int>(m_power.size());
-      return m_power[size-1];
+      double range = 0;
+      for(int k = 0; k < get_num_curves(); ++k)
+      {
+        range = std::max(range, get_max_power(k) - get_min_power(k));
+      }
+      return range;
+    }
+
+    //
+    // Inverse of estimate: the least power that gets a node with the
+    // given original estimate down to target_time. The measured curve
+    // is noisy in the flat region, so this answers against its
+    // monotone envelope. Returns infinity if even max power is too slow.
+    //
+    double min_power_for_time(double orig_estimate, double target_time, const int curve = 0) const
+    {
+      const int start = m_curve_start[curve];
+      const int end = start + m_curve_size[curve];
+      const double diff = orig_estimate * (1.0 + m_percent_change[curve]) - orig_estimate;
+      if(diff <= 0)
+      {
+        // the curve has no effect on this node
+        return target_time >= orig_estimate ? get_min_power(curve) : std::numeric_limits<double>::infinity();
+      }
+      const double normalized_time = (target_time - orig_estimate) / diff;
+      if(normalized_time >= m_times[end - 1])
+      {
+        return get_min_power(curve);
+      }
+      if(normalized_time < m_fastest[start])
+      {
+        return std::numeric_limits<double>::infinity();
+      }
+      //
+      // m_fastest grows with the index, find the highest index that
+      // still meets the target. The curve crosses the target between
+      // that point and the next lower power one.
+      //
+      const std::vector<double>::const_iterator it =
+        std::upper_bound(m_fastest.begin() + start, m_fastest.begin() + end, normalized_time);
+      const int hi = static_cast<int>(it - m_fastest.begin()) - 1;
+      const int lo = hi + 1;
+      assert(hi >= start && lo < end);
+      const double delta = (normalized_time - m_times[lo]) / (m_times[hi] - m_times[lo]);
+      const double power = m_power[lo] + delta * (m_power[hi] - m_power[lo]);
+      return std::max(get_min_power(curve), std::min(get_max_power(curve), power));
     }
 
-    double estimate(double power_value, double orig_estimate) const
+    double estimate(double power_value, double orig_estimate, const int curve = 0) const
     {
-      int min_index = 0;
-      const int size = static_cast<int>(m_power.size());
       //
       // Don't ask for a power value we cant give
       //
-      assert(power_value <= get_max_power() && 
-             power_value >= get_min_power());
+      assert(power_value <= get_max_power(curve) && 
+             power_value >= get_min_power(curve));
+
+      const int max_index = find_segment(curve, power_value);
+      return interpolate(curve, max_index, power_value, orig_estimate);
+    }
 
+    //
+    // Batched version of estimate: times[i] = estimate(power_values[i], orig_estimates[i], curves[i]).
+    // curves may be NULL when every node uses class 0.
+    // Segments are looked up in one pass and interpolated in a second,
+    // branch free pass so the compiler can vectorize it.
+    //
+    void estimate(const double *power_values,
+                  const double *orig_estimates,
+                  const int *curves,
+                  double *times,
+                  const int size) const
+    {
+#ifndef NDEBUG
       for(int i = 0; i < size; ++i)
       {
-        if(m_power[i] >= power_value) 
-        {
-          min_index++;
-        }
-        else break;
+        const int curve = curves == NULL ? 0 : curves[i];
+        assert(power_values[i] <= get_max_power(curve) && 
+               power_values[i] >= get_min_power(curve));
       }
-      if(min_index == size)
+#endif
+      const double * const power = &m_power[0];
+      const double * const norm_times = &m_times[0];
+      const int block = 256;
+      int segs[block];
+      double scales[block];
+      for(int start = 0; start < size; start += block)
       {
-        min_index = size-1;
+        const int count = std::min(block, size - start);
+        if(curves == NULL && m_power_step[0] > 0)
+        {
+          //
+          // Single evenly spaced curve: the segment is one multiply
+          // away, with branch free corrections for rounding next to
+          // a knot (same answer as find_segment).
+          //
+          const double top = power[0];
+          const double inv_step = 1.0 / m_power_step[0];
+          const int last = m_curve_size[0] - 2;
+          const double scale = 1.0 + m_percent_change[0];
+          for(int i = 0; i < count; ++i)
+          {
+            const double p = power_values[start + i];
+            int seg = static_cast<int>((top - p) * inv_step);
+            seg = seg < 0 ? 0 : (seg > last ? last : seg);
+            seg += (seg < last && power[seg + 1] >= p) ? 1 : 0;
+            seg -= (seg > 0 && power[seg] < p) ? 1 : 0;
+            segs[i] = seg;
+            scales[i] = scale;
+          }
+        }
+        else
+        {
+          for(int i = 0; i < count; ++i)
+          {
+            const int curve = curves == NULL ? 0 : curves[start + i];
+            segs[i] = find_segment(curve, power_values[start + i]);
+            scales[i] = 1.0 + m_percent_change[curve];
+          }
+        }
+        for(int i = 0; i < count; ++i)
+        {
+          const int hi = segs[i];
+          const int lo = hi + 1;
+          const double p = power_values[start + i];
+          const double orig = orig_estimates[start + i];
+          const double delta = (p - power[lo]) / (power[hi] - power[lo]);
+          const double normalized_time = norm_times[lo] + delta * (norm_times[hi] - norm_times[lo]);
+          const double diff = orig * scales[i] - orig;
+          times[start + i] = orig + normalized_time * diff;
+        }
       }
-      int max_index = min_index - 1; 
-      //std::cout<<"power_value="<<power_value<<"\n";
-      //std::cout<<"min_index="<<min_index<<", max_index="<<max_index<<"\n";
-      //std::cout<<"m_power[min_index]="<<m_power[min_index]<<", m_power[max_index]="<<m_power[max_index]<<"\n";
-      assert(min_index < size);
-      assert(max_index > -1);
+    }
 
-      double delta = (power_value - m_power[min_index])/(m_power[max_index] - m_power[min_index]);
-      assert(delta >= 0.0 && delta <= 1);
-      double normalized_time = m_times[min_index] + delta * (m_times[max_index] - m_times[min_index]);
-      double diff = orig_estimate * (1.0 + m_percent_change) - orig_estimate;
-      double time = orig_estimate + normalized_time * diff;
-      return time;
+    void estimate(const double *power_values,
+                  const double *orig_estimates,
+                  double *times,
+                  const int size) const
+    {
+      estimate(power_values, orig_estimates, NULL, times, size);
+    }
+
+    // curves may be empty when every node uses class 0
+    void estimate(const std::vector<double> &power_values,
+                  const std::vector<double> &orig_estimates,
+                  std::vector<double> &times,
+                  const std::vector<int> &curves = std::vector<int>()) const
+    {
+      assert(power_values.size() == orig_estimates.size());
+      assert(curves.empty() || curves.size() == power_values.size());
+      times.resize(power_values.size());
+      if(times.empty()) return;
+      estimate(&power_values[0],
+               &orig_estimates[0],
+               curves.empty() ? NULL : &curves[0],
+               &times[0],
+               static_cast<int>(times.size()));
     }
 };  // class estimator 
 
@@ -106,109 +599,347 @@ struct Adjustment
   double amount;
 };
 
+//
+// Per-node power as whole steps of m_quantum watts above m_base, two
+// bytes a node instead of eight, so a 1M node allocation takes 2 MB.
+// Caps are whole watts in practice; with the quantum the greedy used
+// (its power_inc) values come back to within rounding. Values off the
+// lattice are rounded down so the budget is never exceeded.
+//
+struct QuantizedPower
+{
+  double m_base;
+  double m_quantum;
+  std::vector<uint16_t> m_steps;
+
+  QuantizedPower()
+    : m_base(0),
+      m_quantum(1)
+  {
+  }
+
+  // false if a value is below base or more than 65535 steps above it
+  bool quantize(const std::vector<double> &power, const double base, const double quantum)
+  {
+    assert(quantum > 0);
+    m_base = base;
+    m_quantum = quantum;
+    m_steps.resize(power.size());
+    for(size_t i = 0; i < power.size(); ++i)
+    {
+      // a value on the lattice can land a hair below its step
+      const double steps = std::floor((power[i] - base) / quantum + 1e-9);
+      if(steps < 0 || steps > 65535)
+      {
+        return false;
+      }
+      m_steps[i] = static_cast<uint16_t>(steps);
+    }
+    return true;
+  }
+
+  size_t size() const
+  {
+    return m_steps.size();
+  }
+
+  double power(const size_t i) const
+  {
+    return m_base + m_steps[i] * m_quantum;
+  }
+
+  void to_vector(std::vector<double> &power_values) const
+  {
+    power_values.resize(m_steps.size());
+    for(size_t i = 0; i < m_steps.size(); ++i)
+    {
+      power_values[i] = power(i);
+    }
+  }
+}; // struct QuantizedPower
+
 struct PowerAllocation
 {
   // Pointer to data share between other instances 
   Estimator *m_estimator;
-  const std::vector<double> *m_orig_estimates;
+  // one estimate per node, borrowed from the optimizer
+  const double *m_orig_estimates;
+  // curve class of each node, NULL or empty when all use class 0
+  const std::vector<int> *m_curves;
   
   std::vector<double> m_power_values;
   std::vector<double> m_times;
+  // max tree over m_times so the bottleneck is always known
+  MaxTree m_time_index;
+  //
+  // Donors ordered by the time they would have after giving away
+  // m_donor_inc watts, infinity for nodes that can't give. Kept in
+  // step with every change so a later solve can pick up from here.
+  // m_donor_inc == 0 means the index is not built.
+  //
+  MinTree m_donor_index;
+  double m_donor_inc;
+  // runtime of the even split we started from
+  double m_initial_runtime;
+  // counters and phase timers of the solves that produced this,
+  // mutable so const lookups can count their estimates
+  mutable SolverStats m_stats;
 
   PowerAllocation(const int size, 
                   const double ave_power_per_node, // evenly distributed power given some cap
-                  const std::vector<double> *orig_estimates,
-                  Estimator *estimator)
+                  const double *orig_estimates,
+                  Estimator *estimator,
+                  const std::vector<int> *curves = NULL)
     : m_power_values(size, ave_power_per_node),
       m_orig_estimates(orig_estimates),
       m_estimator(estimator),
+      m_curves(curves),
       m_times(size,0)
+  {
+    init(size, ave_power_per_node);
+  }
+
+  PowerAllocation(const int size, 
+                  const double ave_power_per_node,
+                  const std::vector<double> *orig_estimates,
+                  Estimator *estimator,
+                  const std::vector<int> *curves = NULL)
+    : m_power_values(size, ave_power_per_node),
+      m_orig_estimates(&(*orig_estimates)[0]),
+      m_estimator(estimator),
+      m_curves(curves),
+      m_times(size,0)
+  {
+    assert(size == orig_estimates->size());
+    init(size, ave_power_per_node);
+  }
+
+  void init(const int size, const double ave_power_per_node)
   {
     assert(size == m_times.size());
-    assert(size == m_orig_estimates->size());
+    assert(m_orig_estimates != NULL);
     assert(size > 0);
     assert(m_estimator != NULL);
-    // init times given ave power per node 
+    assert(!has_curves() || size == m_curves->size());
+    // a node can't be given more or less than its own curve allows,
+    // and raising some to their min mustn't overspend the budget
+    const double level = m_estimator->get_even_split_level(ave_power_per_node,
+                                                           has_curves() ? &(*m_curves)[0] : NULL, size);
     for(int i = 0; i < size; ++i)
     {
-      m_times[i] = m_estimator->estimate(ave_power_per_node, m_orig_estimates->at(i));
+      m_power_values[i] = std::max(get_min_power(i), std::min(get_max_power(i), level));
     }
+    m_donor_inc = 0;
+    // init times given ave power per node 
+    update_times();
+    m_initial_runtime = get_max_runtime();
+  }
+  
+  bool has_curves() const
+  {
+    return m_curves != NULL && !m_curves->empty();
+  }
+
+  int get_curve(const int node) const
+  {
+    return has_curves() ? (*m_curves)[node] : 0;
+  }
+
+  double get_max_power(const int node) const
+  {
+    return m_estimator->get_max_power(get_curve(node));
+  }
 
-    const int vsize = static_cast<int>(m_times.size());
-    std::cout<<"Node | Power  | Time\n";
-    std::cout<<"--------------------\n";
-    for(int i = 0; i < vsize; ++i)
+  double get_min_power(const int node) const
+  {
+    return m_estimator->get_min_power(get_curve(node));
+  }
+
+  double estimate(const int node, const double power_value) const
+  {
+    PP_STAT(m_stats.m_estimate_calls++);
+    return m_estimator->estimate(power_value, m_orig_estimates[node], get_curve(node));
+  }
+
+  // recompute every time from m_power_values
+  void update_times()
+  {
+    PP_STAT(m_stats.m_estimate_calls += m_power_values.size());
+    m_times.resize(m_power_values.size());
+    m_estimator->estimate(&m_power_values[0],
+                          m_orig_estimates,
+                          has_curves() ? &(*m_curves)[0] : NULL,
+                          &m_times[0],
+                          static_cast<int>(m_times.size()));
+    rebuild_index();
+    m_donor_inc = 0;
+  }
+
+  // time node i would have after giving away m_donor_inc
+  double donor_key(const int i) const
+  {
+    if(m_power_values[i] - m_donor_inc < get_min_power(i))
     {
-      if(m_times[i] == get_max_runtime())
-      {
-        std::cout<<std::setw(2)<<i<<"   | "<<std::setprecision(3)<<std::setw(6)<<m_power_values[i]<<" | "<<std::setprecision(5)<<m_times[i]<<" *\n";
-      }
-      else
-      {
-        std::cout<<std::setw(2)<<i<<"   | "<<std::setprecision(3)<<std::setw(6)<<m_power_values[i]<<" | "<<std::setprecision(5)<<m_times[i]<<"\n";
-      }
+      // giving power would result in going below the min power threshold
+      return std::numeric_limits<double>::infinity();
     }
-    std::cout<<"Runtime: "<<std::setprecision(5)<<get_max_runtime()<<"\n";
+    return estimate(i, m_power_values[i] - m_donor_inc);
   }
-  
-  int get_max_index() const 
+
+  void build_donor_index(const double power_inc)
   {
-    const int size = static_cast<int>(m_times.size());
-    int max_index = 0; 
-    double max_value = m_times[0];
-    for(int i = 1; i < size; ++i)
+    PP_PHASE(m_stats, m_init_ms);
+    const int size = static_cast<int>(m_power_values.size());
+    PP_STAT(m_stats.m_estimate_calls += size);
+    std::vector<double> donor_power(size);
+    for(int i = 0; i < size; ++i)
+    {
+      donor_power[i] = std::max(m_power_values[i] - power_inc, get_min_power(i));
+    }
+    std::vector<double> donor_keys(size);
+    m_estimator->estimate(&donor_power[0],
+                          m_orig_estimates,
+                          has_curves() ? &(*m_curves)[0] : NULL,
+                          &donor_keys[0],
+                          size);
+    m_donor_inc = power_inc;
+    for(int i = 0; i < size; ++i)
     {
-      if(m_times[i] > max_value) 
+      if(m_power_values[i] - power_inc < get_min_power(i))
       {
-        max_index = i;
-        max_value = m_times[i]; 
+        donor_keys[i] = std::numeric_limits<double>::infinity();
       }
     }
-    return max_index;
+    m_donor_index.build(donor_keys);
+  }
+
+  //
+  // Re-estimate one node after its power or original estimate
+  // changed by hand. O(log N).
+  //
+  void update_node(const int node)
+  {
+    m_times[node] = estimate(node, m_power_values[node]);
+    m_time_index.update(node, m_times[node]);
+    if(m_donor_inc != 0)
+    {
+      m_donor_index.update(node, donor_key(node));
+    }
+  }
+
+  // must be called if m_times is changed by hand
+  void rebuild_index()
+  {
+    m_time_index.build(m_times);
+  }
+
+  int get_max_index() const 
+  {
+    return m_time_index.winner();
   } // get max
 
   double get_max_runtime() const 
   {
-    const int size = static_cast<int>(m_times.size());
-    double max_value = m_times[0];
-    for(int i = 1; i < size; ++i)
+    return m_times[get_max_index()];
+  } // get max runtime
+
+  // max time over every node except (up to) two, -1 to not skip
+  int get_max_index_excluding(const int skip_a, const int skip_b) const
+  {
+    return m_time_index.winner_excluding(skip_a, skip_b);
+  }
+
+  // replace every node's power at once
+  void set_power(const std::vector<double> &power_values)
+  {
+    assert(power_values.size() == m_power_values.size());
+    m_power_values = power_values;
+    update_times();
+  }
+
+  //
+  // Compact copy of the power values, steps of quantum watts above the
+  // lowest min power of any curve. Check the result's size: it is
+  // empty if a value does not fit in 16 bits of steps.
+  //
+  QuantizedPower quantize(const double quantum) const
+  {
+    double base = std::numeric_limits<double>::infinity();
+    for(int k = 0; k < m_estimator->get_num_curves(); ++k)
     {
-      if(m_times[i] > max_value) 
-      {
-        max_value = m_times[i]; 
-      }
+      base = std::min(base, m_estimator->get_min_power(k));
     }
-    return max_value;
-  } // get max runtime
+    QuantizedPower quantized;
+    if(!quantized.quantize(m_power_values, base, quantum))
+    {
+      quantized.m_steps.clear();
+    }
+    return quantized;
+  }
+
+  // restore quantized power values, kept within each node's curve
+  void set_power(const QuantizedPower &quantized)
+  {
+    assert(quantized.size() == m_power_values.size());
+    for(size_t i = 0; i < m_power_values.size(); ++i)
+    {
+      const int node = static_cast<int>(i);
+      m_power_values[i] = std::max(get_min_power(node), std::min(get_max_power(node), quantized.power(i)));
+    }
+    update_times();
+  }
+
+  double get_total_power() const
+  {
+    double total = 0;
+    const int size = static_cast<int>(m_power_values.size());
+    for(int i = 0; i < size; ++i)
+    {
+      total += m_power_values[i];
+    }
+    return total;
+  }
 
   void apply_adjustment(const Adjustment &adj)
   {
+    PP_PHASE(m_stats, m_apply_ms);
+    PP_STAT(m_stats.m_adjustments++);
+    PP_STAT(m_stats.m_estimate_calls += 2);
     double power_from     = m_power_values[adj.from];
     double power_to       = m_power_values[adj.to];
     double new_power_to   = power_to + adj.amount;
     double new_power_from = power_from - adj.amount;
-    double time_from      = m_orig_estimates->at(adj.from);
-    double time_to        = m_orig_estimates->at(adj.to);
-    double new_est_from   = m_estimator->estimate(new_power_from, time_from);
-    double new_est_to     = m_estimator->estimate(new_power_to, time_to);
+    double time_from      = m_orig_estimates[adj.from];
+    double time_to        = m_orig_estimates[adj.to];
+    double new_est_from   = m_estimator->estimate(new_power_from, time_from, get_curve(adj.from));
+    double new_est_to     = m_estimator->estimate(new_power_to, time_to, get_curve(adj.to));
     
     // save the values
     m_power_values[adj.from] -= adj.amount;
     m_power_values[adj.to]   +=  adj.amount;
     m_times[adj.from] = new_est_from;
     m_times[adj.to] = new_est_to;
+    m_time_index.update(adj.from, new_est_from);
+    m_time_index.update(adj.to, new_est_to);
+    if(m_donor_inc != 0)
+    {
+      m_donor_index.update(adj.from, donor_key(adj.from));
+      m_donor_index.update(adj.to, donor_key(adj.to));
+    }
   }
 
   double check_adjustment(const Adjustment &adj, bool verbose)
   {
+    PP_STAT(m_stats.m_candidates++);
+    PP_STAT(m_stats.m_estimate_calls += 2);
     double power_from     = m_power_values[adj.from];
     double power_to       = m_power_values[adj.to];
     double new_power_to   = power_to + adj.amount;
     double new_power_from = power_from - adj.amount;
-    double time_from      = m_orig_estimates->at(adj.from);
-    double time_to        = m_orig_estimates->at(adj.to);
-    double new_est_from   = m_estimator->estimate(new_power_from, time_from);
-    double new_est_to     = m_estimator->estimate(new_power_to, time_to);
+    double time_from      = m_orig_estimates[adj.from];
+    double time_to        = m_orig_estimates[adj.to];
+    double new_est_from   = m_estimator->estimate(new_power_from, time_from, get_curve(adj.from));
+    double new_est_to     = m_estimator->estimate(new_power_to, time_to, get_curve(adj.to));
 
     if(verbose == true)
     {
@@ -217,145 +948,550 @@ struct PowerAllocation
       std::cout<<time_to<<" "<<m_times[adj.to]<<" "<<new_power_to<<" "<<std::setprecision(5)<<new_est_to<<"\n";
     }
     
-    const int size = static_cast<int>(m_times.size());
-
-    double max_value = m_times[0];
-
-    if(adj.from == 0)
+    double max_value = std::max(new_est_from, new_est_to);
+    const int rest_idx = get_max_index_excluding(adj.from, adj.to);
+    if(rest_idx != -1)
     {
-      max_value = new_est_from;
+      max_value = std::max(max_value, m_times[rest_idx]);
     }
-    if(adj.to == 0)
+    return max_value;
+  }
+
+  //
+  // Human readable table. Rows are formatted into one buffer and
+  // written at once, so large allocations don't pay per row stream
+  // overhead.
+  //
+  void print(std::ostream &out) const
+  {
+    const int size = static_cast<int>(m_times.size());
+    const double max_runtime = get_max_runtime();
+    std::string buffer;
+    buffer.reserve(40 * (size + 3));
+    buffer += "Node | Power  | Time\n";
+    buffer += "--------------------\n";
+    char row[128];
+    for(int i = 0; i < size; ++i)
     {
-      max_value = new_est_to;
+      snprintf(row, sizeof(row), "%2d   | %6.3g | %.5g%s\n",
+               i, m_power_values[i], m_times[i],
+               m_times[i] == max_runtime ? " *" : "");
+      buffer += row;
     }
+    snprintf(row, sizeof(row), "Runtime: %.5g\n", max_runtime);
+    buffer += row;
+    out.write(buffer.data(), buffer.size());
+  }
 
-    for(int i = 1; i < size; ++i)
-    {
-      double val = m_times[i];
+  void print() const
+  {
+    print(std::cout);
+  }
+}; //class PowerAllocation
 
-      if(adj.from == i)
-      {
-        val = new_est_from;
-      }
-      if(adj.to == i)
-      {
-        val = new_est_to;
-      }
+enum SolverType
+{
+  GREEDY,       // move power_inc watts to the bottleneck each round
+  ADAPTIVE,     // greedy with steps shrinking down to power_inc
+  WATER_FILL    // bisect on the target runtime
+};
 
-      if(val > max_value) 
-      {
-        max_value = val; 
-      }
+//
+// The greedy's donor choice, shared by PowerOptimizer and
+// LevelOptimizer so both move power the same way: the donor whose
+// transfer to the bottleneck gives the lowest max time, -1 if no
+// transfer helps. O(log N). times and time_index hold every node's
+// time, donors every node's time after giving (infinity if it can't)
+// and new_time() the bottleneck's time after taking. stats, if not
+// NULL, counts the candidates scored.
+//
+template <class NewTime>
+inline int pick_greedy_donor(const MaxTree &time_index,
+                             const MinTree &donors,
+                             const std::vector<double> &times,
+                             const int bottleneck_idx,
+                             NewTime new_time,
+                             SolverStats *stats)
+{
+  //
+  // Giving to the bottleneck from donor i yields
+  //   max(new_to, key_i, max of everyone but i and the bottleneck).
+  // The last term is the runner up time for every donor except the
+  // runner up itself, so only two candidates need to be scored:
+  // the runner up and the best keyed donor among the rest.
+  //
+  const int runner_up = time_index.winner_excluding(bottleneck_idx, -1);
+  if(runner_up == -1)
+  {
+    // nobody to take power from
+    return -1;
+  }
+  const double new_to = new_time();
+  const double floor_time = std::max(new_to, times[runner_up]);
+  const double inf = std::numeric_limits<double>::infinity();
+
+  double runner_up_time = inf;
+  if(stats != NULL) { PP_STAT(stats->m_candidates++); }
+  if(donors.value(runner_up) != inf)
+  {
+    runner_up_time = std::max(new_to, donors.value(runner_up));
+    const int third = time_index.winner_excluding(bottleneck_idx, runner_up);
+    if(third != -1)
+    {
+      runner_up_time = std::max(runner_up_time, times[third]);
     }
-    return max_value;
+  }
+  else if(stats != NULL)
+  {
+    PP_STAT(stats->m_rejected_min_power++);
   }
 
-  void print()
+  double rest_time = inf;
+  const int best_rest = donors.winner_excluding(bottleneck_idx, runner_up);
+  if(best_rest != -1)
   {
-    const int size = static_cast<int>(m_times.size());
-    std::cout<<"Node | Power  | Time\n";
-    std::cout<<"--------------------\n";
-    for(int i = 0; i < size; ++i)
+    if(stats != NULL) { PP_STAT(stats->m_candidates++); }
+    if(donors.value(best_rest) != inf)
     {
-      if(m_times[i] == get_max_runtime())
-      {
-        std::cout<<std::setw(2)<<i<<"   | "<<std::setprecision(3)<<std::setw(6)<<m_power_values[i]<<" | "<<std::setprecision(5)<<m_times[i]<<" *\n";
-      }
-      else
-      {
-        std::cout<<std::setw(2)<<i<<"   | "<<std::setprecision(3)<<std::setw(6)<<m_power_values[i]<<" | "<<std::setprecision(5)<<m_times[i]<<"\n";
-      }
+      rest_time = std::max(floor_time, donors.value(best_rest));
+    }
+    else if(stats != NULL)
+    {
+      // the best keyed donor can't give, so none of the rest can
+      PP_STAT(stats->m_rejected_min_power++);
     }
-    std::cout<<"Runtime: "<<std::setprecision(5)<<get_max_runtime()<<"\n";
   }
-}; //class PowerAllocation
+
+  const double best_adj_time = std::min(runner_up_time, rest_time);
+  if(!(best_adj_time < times[bottleneck_idx]))
+  {
+    return -1;
+  }
+  // same tie breaking as a linear scan: lowest index that is best
+  int from = -1;
+  if(rest_time == best_adj_time)
+  {
+    from = donors.first_within_excluding(bottleneck_idx, runner_up, best_adj_time);
+  }
+  if(runner_up_time == best_adj_time && (from == -1 || runner_up < from))
+  {
+    from = runner_up;
+  }
+  assert(from != -1);
+  return from;
+}
 
 class PowerOptimizer
 {
 protected:
-  Estimator m_estimator; 
-  std::vector<double> m_orig_estimates; 
+  //
+  // The estimator and estimates are either the optimizer's own copies
+  // (m_owned_*) or borrowed through the view constructor, in which
+  // case the caller keeps them alive for as long as the optimizer and
+  // every allocation it returns.
+  //
+  std::unique_ptr<Estimator> m_owned_estimator;
+  Estimator *m_estimator;
+  std::vector<double> m_owned_estimates;
+  EstimateView m_orig_estimates;
+  // curve class per node, empty when every node uses class 0
+  std::vector<int> m_curves;
   bool m_is_verbose;
+  bool m_is_quiet;
+  bool m_is_timing;
+
+  // allocations point into this object, copies would dangle
+  PowerOptimizer(const PowerOptimizer &);
+  PowerOptimizer& operator=(const PowerOptimizer &);
+
+  void check_curves() const
+  {
+    assert(m_curves.empty() || m_curves.size() == m_orig_estimates.size());
+    for(size_t i = 0; i < m_curves.size(); ++i)
+    {
+      assert(m_curves[i] >= 0 && m_curves[i] < m_estimator->get_num_curves());
+    }
+  }
+
+  // take a private copy of borrowed estimates before changing them
+  void own_estimates(PowerAllocation &allocation)
+  {
+    if(m_owned_estimates.empty())
+    {
+      m_owned_estimates.assign(m_orig_estimates.begin(), m_orig_estimates.end());
+      m_orig_estimates = EstimateView(m_owned_estimates);
+      allocation.m_orig_estimates = m_orig_estimates.data();
+    }
+  }
 public:
   PowerOptimizer(Estimator &e, 
                  const std::vector<double> &estimates,
                  bool verbose)
-    : m_estimator(e),
-      m_orig_estimates(estimates),
-      m_is_verbose(verbose) 
+    : m_owned_estimator(new Estimator(e)),
+      m_estimator(m_owned_estimator.get()),
+      m_owned_estimates(estimates),
+      m_orig_estimates(m_owned_estimates),
+      m_is_verbose(verbose),
+      m_is_quiet(false),
+      m_is_timing(false)
   {
       
   }
 
-  PowerAllocation optimize(double ave_power_per_node, double power_inc, bool verbose)
+  // nodes with their own curve classes, see Estimator::add_curve
+  PowerOptimizer(Estimator &e, 
+                 const std::vector<double> &estimates,
+                 const std::vector<int> &curves,
+                 bool verbose)
+    : m_owned_estimator(new Estimator(e)),
+      m_estimator(m_owned_estimator.get()),
+      m_owned_estimates(estimates),
+      m_orig_estimates(m_owned_estimates),
+      m_curves(curves),
+      m_is_verbose(verbose),
+      m_is_quiet(false),
+      m_is_timing(false)
   {
-    // create the inital power allocation
+    check_curves();
+  }
+
+  //
+  // Zero copy: borrows e and the estimates (a vector, or an mmap'ed
+  // file through EstimateSource::view) instead of copying them.
+  // Estimates are only copied if reoptimize() has to change them.
+  //
+  PowerOptimizer(Estimator &e,
+                 const EstimateView &estimates,
+                 const std::vector<int> &curves,
+                 bool verbose)
+    : m_estimator(&e),
+      m_orig_estimates(estimates),
+      m_curves(curves),
+      m_is_verbose(verbose),
+      m_is_quiet(false),
+      m_is_timing(false)
+  {
+    check_curves();
+  }
+
+  // quiet optimizers don't print the starting allocation
+  void set_quiet(bool quiet)
+  {
+    m_is_quiet = quiet;
+  }
+
+  // time the init/search/apply phases of every solve (see SolverStats)
+  void set_timing(bool timing)
+  {
+    m_is_timing = timing;
+  }
+
+  //
+  // The estimator solves run against: the optimizer's own copy, or the
+  // borrowed one. Refining it (Estimator::add_samples) takes effect on
+  // the next solve.
+  //
+  Estimator& get_estimator()
+  {
+    return *m_estimator;
+  }
+
+  const EstimateView& get_estimates() const
+  {
+    return m_orig_estimates;
+  }
+
+  int get_curve(const int node) const
+  {
+    return m_curves.empty() ? 0 : m_curves[node];
+  }
+
+  // least total power that runs every node, each at its min power
+  double get_min_budget() const
+  {
+    double total = 0;
+    for(size_t i = 0; i < m_orig_estimates.size(); ++i)
+    {
+      total += m_estimator->get_min_power(get_curve(static_cast<int>(i)));
+    }
+    return total;
+  }
+
+  // what the even split spends: the budget, less what nodes at their
+  // max power can't take
+  double get_budget(double ave_power_per_node) const
+  {
+    const int size = static_cast<int>(m_orig_estimates.size());
+    const double level = m_estimator->get_even_split_level(ave_power_per_node,
+                                                           m_curves.empty() ? NULL : &m_curves[0], size);
+    double total = 0;
+    for(int i = 0; i < size; ++i)
+    {
+      const int curve = get_curve(i);
+      total += std::max(m_estimator->get_min_power(curve), std::min(m_estimator->get_max_power(curve), level));
+    }
+    return total;
+  }
+
+  // the even split every solver starts from
+  PowerAllocation start_allocation(double ave_power_per_node)
+  {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
     PowerAllocation allocation(m_orig_estimates.size(),
                                ave_power_per_node,
-                               &m_orig_estimates,
-                               &m_estimator);
+                               m_orig_estimates.data(),
+                               m_estimator,
+                               &m_curves);
+    allocation.m_stats.m_timing = m_is_timing;
+    if(POWER_PLAY_STATS && m_is_timing)
+    {
+      allocation.m_stats.m_init_ms += std::chrono::duration<double, std::milli>(
+                                        std::chrono::steady_clock::now() - start).count();
+    }
+    if(!m_is_quiet)
+    {
+      allocation.print();
+    }
+    return allocation;
+  }
+
+  //
+  // The donor whose transfer of power_inc to the bottleneck gives the
+  // lowest max runtime, -1 if no transfer helps. O(log N).
+  //
+  int pick_donor(PowerAllocation &allocation, const int bottleneck_idx, const double power_inc) const
+  {
+    return pick_greedy_donor(allocation.m_time_index, allocation.m_donor_index, allocation.m_times,
+                             bottleneck_idx,
+                             [&]() { return allocation.estimate(bottleneck_idx,
+                                                                allocation.m_power_values[bottleneck_idx] + power_inc); },
+                             &allocation.m_stats);
+  }
+
+  //
+  // Greedy rounds at a fixed step until no transfer of power_inc to
+  // the bottleneck helps. Returns the number of rounds run.
+  //
+  int greedy_rounds(PowerAllocation &allocation, double power_inc, bool verbose)
+  {
+    // donors keyed for this step, reused if the allocation has them
+    if(allocation.m_donor_inc != power_inc)
+    {
+      allocation.build_donor_index(power_inc);
+    }
+
     bool progress = true;
-    const int size = static_cast<int>(m_orig_estimates.size());
     int round  = 0;
     while(progress)
     {
       int bottleneck_idx = allocation.get_max_index();
-      double bottleneck_time = allocation.m_times[bottleneck_idx];
 
-      if(allocation.m_power_values[bottleneck_idx] + power_inc > m_estimator.get_max_power())
+      if(allocation.m_power_values[bottleneck_idx] + power_inc > allocation.get_max_power(bottleneck_idx))
       {
         if(verbose == true)
         {
           std::cout<<"Breaking because bottleneck is at TDP\n";
         }
+        PP_STAT(allocation.m_stats.m_rejected_tdp++);
         break;
       }
       if(verbose == true)
       {
         std::cout<<"---- Round "<<round<<" ----\n";
       }
-        
-      Adjustment best_adj;
-      double best_adj_time = bottleneck_time; 
+
       progress = false;
-      for(int i = 0; i < size; ++i)
+      int from = -1;
       {
-        // Check for conditions that can't be done
-        if(i == bottleneck_idx) 
-        {
-          // we can't give from the bottleneck
-          continue;
-        }
-        if(allocation.m_power_values[i] - power_inc < m_estimator.get_min_power())
-        {
-          // giving power would result in going below the min power threshold
-          continue; 
-        }
-        
-        Adjustment temp;
-        temp.to = bottleneck_idx;
-        temp.from = i;
-        temp.amount = power_inc;
-        
-        double temp_time = allocation.check_adjustment(temp, verbose);
-        //std::cout<<i<<" new time "<<temp_time<<" best "<<best_adj_time<<"\n";
-        if(temp_time < best_adj_time)
+        PP_PHASE(allocation.m_stats, m_search_ms);
+        from = pick_donor(allocation, bottleneck_idx, power_inc);
+      }
+      if(from != -1)
+      {
+        Adjustment best_adj;
+        best_adj.to = bottleneck_idx;
+        best_adj.from = from;
+        best_adj.amount = power_inc;
+        if(verbose == true)
         {
-          best_adj_time = temp_time;  
-          best_adj = temp;
-          progress = true;
+          allocation.check_adjustment(best_adj, verbose);
         }
-    
-      } // for
-
-      if(progress)
-      {
         allocation.apply_adjustment(best_adj);
+        progress = true;
       }
       round++;
     }  // while making progress 
+    allocation.m_stats.m_rounds += round;
+    return round;
+  }
+
+  PowerAllocation optimize(double ave_power_per_node, double power_inc, bool verbose)
+  {
+    // create the inital power allocation
+    PowerAllocation allocation = start_allocation(ave_power_per_node);
+    greedy_rounds(allocation, power_inc, verbose);
     return allocation;
   }
+
+  //
+  // Warm start: change the estimates of some nodes and repair an
+  // allocation this optimizer produced, instead of solving from the
+  // even split again. Each changed node costs O(log N) and the greedy
+  // then only runs the rounds needed to fix the bottleneck, reusing
+  // the allocation's donor index when power_inc is unchanged.
+  // m_initial_runtime is reset to the runtime right after the change.
+  // Returns the number of greedy rounds.
+  //
+  int reoptimize(PowerAllocation &allocation,
+                 const std::vector<int> &nodes,
+                 const std::vector<double> &new_estimates,
+                 double power_inc,
+                 bool verbose)
+  {
+    assert(allocation.m_orig_estimates == m_orig_estimates.data());
+    assert(nodes.size() == new_estimates.size());
+    if(!nodes.empty())
+    {
+      own_estimates(allocation);
+    }
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+      assert(nodes[i] >= 0 && nodes[i] < static_cast<int>(m_owned_estimates.size()));
+      m_owned_estimates[nodes[i]] = new_estimates[i];
+      allocation.update_node(nodes[i]);
+    }
+    allocation.m_initial_runtime = allocation.get_max_runtime();
+    return greedy_rounds(allocation, power_inc, verbose);
+  }
+
+  // same as above with a whole new estimate vector, only the entries
+  // that differ are touched
+  int reoptimize(PowerAllocation &allocation,
+                 const std::vector<double> &estimates,
+                 double power_inc,
+                 bool verbose)
+  {
+    assert(estimates.size() == m_orig_estimates.size());
+    std::vector<int> nodes;
+    std::vector<double> values;
+    for(size_t i = 0; i < estimates.size(); ++i)
+    {
+      if(estimates[i] != m_orig_estimates[i])
+      {
+        nodes.push_back(static_cast<int>(i));
+        values.push_back(estimates[i]);
+      }
+    }
+    return reoptimize(allocation, nodes, values, power_inc, verbose);
+  }
+
+  //
+  // Coarse to fine greedy: run the greedy with a large step, and halve
+  // the step whenever it stalls, ending with a pass at power_inc. Steps
+  // are power_inc * 2^k so every power value stays on the same lattice
+  // as the plain greedy, whose stopping rule the final pass keeps.
+  //
+  PowerAllocation optimize_adaptive(double ave_power_per_node, double power_inc, bool verbose)
+  {
+    PowerAllocation allocation = start_allocation(ave_power_per_node);
+    const double range = m_estimator->get_max_power_range();
+    double step = power_inc;
+    while(step * 2 <= range / 4)
+    {
+      step *= 2;
+    }
+    while(true)
+    {
+      if(verbose == true)
+      {
+        std::cout<<"==== Step "<<step<<" ====\n";
+      }
+      greedy_rounds(allocation, step, verbose);
+      if(step <= power_inc) break;
+      step = std::max(power_inc, step / 2);
+    }
+    return allocation;
+  }
+
+  //
+  // Water filling: bisect on the target runtime T. For a given T every
+  // node needs at least min_power_for_time(T) watts, and T is feasible
+  // when those needs fit in the budget. Cost is O(N log K) per step and
+  // does not depend on any power increment. Power left over at the
+  // final T stays unassigned: on the flat part of the curve more watts
+  // can make a node slower, so it is not handed out blindly.
+  //
+  PowerAllocation optimize_water_fill(double ave_power_per_node, double tolerance, bool verbose)
+  {
+    PowerAllocation allocation = start_allocation(ave_power_per_node);
+    const int size = static_cast<int>(m_orig_estimates.size());
+    const std::vector<double> even_power = allocation.m_power_values;
+    const double budget = allocation.get_total_power();
+
+    // the even split is feasible, no node gets below its envelope minimum
+    double hi = allocation.get_max_runtime();
+    double lo = 0;
+    for(int i = 0; i < size; ++i)
+    {
+      lo = std::max(lo, m_estimator->get_fastest_time(m_orig_estimates[i], allocation.get_curve(i)));
+    }
+
+    std::vector<double> power(size);
+    std::vector<double> best_power = even_power;
+    int steps = 0;
+    PP_PHASE(allocation.m_stats, m_search_ms);
+    while(hi - lo > tolerance * hi && steps < 200)
+    {
+      const double target = 0.5 * (lo + hi);
+      double total = 0;
+      for(int i = 0; i < size && total <= budget; ++i)
+      {
+        power[i] = m_estimator->min_power_for_time(m_orig_estimates[i], target, allocation.get_curve(i));
+        total += power[i];
+      }
+      if(verbose == true)
+      {
+        std::cout<<"---- Step "<<steps<<" ---- target "<<std::setprecision(8)<<target
+                 <<" power "<<total<<" budget "<<budget<<"\n";
+      }
+      allocation.m_stats.m_rounds++;
+      PP_STAT(allocation.m_stats.m_inverse_calls += size);
+      if(total <= budget)
+      {
+        hi = target;
+        best_power = power;
+      }
+      else
+      {
+        lo = target;
+      }
+      steps++;
+    }
+
+    allocation.set_power(best_power);
+    // never hand back something worse than where we started
+    if(allocation.get_max_runtime() > allocation.m_initial_runtime)
+    {
+      allocation.set_power(even_power);
+    }
+    return allocation;
+  }
+
+  //
+  // Run the selected solver. power_inc only matters to the greedy,
+  // water filling bisects to a fixed relative tolerance.
+  //
+  PowerAllocation solve(SolverType solver, double ave_power_per_node, double power_inc, bool verbose)
+  {
+    if(solver == WATER_FILL)
+    {
+      return optimize_water_fill(ave_power_per_node, 1e-6, verbose);
+    }
+    if(solver == ADAPTIVE)
+    {
+      return optimize_adaptive(ave_power_per_node, power_inc, verbose);
+    }
+    return optimize(ave_power_per_node, power_inc, verbose);
+  }
 };
 #endif
@@ -0,0 +1,331 @@
+#ifndef fixed_optimizer_h
+#define fixed_optimizer_h
+
+#include <array>
+#include <limits>
+#include <algorithm>
+#include <assert.h>
+
+#include "estimator.h"
+#include "default_curve.h"
+
+//
+// Estimator and greedy solver with the node count and curve length
+// fixed at compile time, for small jobs that are re-solved every
+// timestep. Everything lives in std::array, so the loops below have
+// constant trip counts the compiler can unroll and vectorize, and the
+// curve tables can be built as constexpr data.
+//
+// Results are bit for bit those of Estimator / PowerOptimizer::optimize
+// with a single curve class: the same normalization, segment choice,
+// interpolation, bottleneck and donor tie breaking.
+//
+template<int CurveSize>
+class FixedEstimator
+{
+  static_assert(CurveSize > 1, "a curve needs at least two points");
+protected:
+  std::array<double, CurveSize> m_power;
+  std::array<double, CurveSize> m_times;   // normalized, as in Estimator
+  double m_scale;                          // 1 + percent change
+  // > 0 when the knots are evenly spaced, see Estimator::m_power_step
+  double m_power_step;
+  double m_inv_step;
+public:
+  // same layout as Estimator: times[0] fastest, power[0] highest
+  constexpr FixedEstimator(const double (&times)[CurveSize], const double (&power)[CurveSize])
+    : m_power(),
+      m_times(),
+      m_scale(1),
+      m_power_step(0),
+      m_inv_step(0)
+  {
+    double max_val = -1;
+    double min_val = 1e30;
+    for(int i = 0; i < CurveSize; ++i)
+    {
+      max_val = std::max(max_val, times[i]);
+      min_val = std::min(min_val, times[i]);
+    }
+    for(int i = 0; i < CurveSize; ++i)
+    {
+      m_times[i] = (times[i] - min_val) / (max_val - min_val);
+      m_power[i] = power[i];
+    }
+    m_scale = 1.0 + (max_val - min_val) / max_val;
+
+    const double step = (power[0] - power[CurveSize - 1]) / (CurveSize - 1);
+    bool even = true;
+    for(int i = 1; i < CurveSize; ++i)
+    {
+      const double gap = (power[i - 1] - power[i]) - step;
+      even = even && (gap < 0 ? -gap : gap) <= 1e-9 * step;
+    }
+    if(even)
+    {
+      m_power_step = step;
+      m_inv_step = 1.0 / step;
+    }
+  }
+
+  constexpr double get_max_power() const
+  {
+    return m_power[0];
+  }
+
+  constexpr double get_min_power() const
+  {
+    return m_power[CurveSize - 1];
+  }
+
+  // the caller keeps power_value within [get_min_power(), get_max_power()]
+  double estimate(const double power_value, const double orig_estimate) const
+  {
+    //
+    // Higher power end of the segment: the last knot at or above
+    // power_value, the same segment Estimator::find_segment picks.
+    // Evenly spaced curves get it with one multiply and the branch
+    // free corrections of the batched Estimator::estimate.
+    //
+    const int last = CurveSize - 2;
+    int hi = 0;
+    if(m_power_step > 0)
+    {
+      hi = static_cast<int>((m_power[0] - power_value) * m_inv_step);
+      hi = hi < 0 ? 0 : (hi > last ? last : hi);
+      hi += (hi < last && m_power[hi + 1] >= power_value) ? 1 : 0;
+      hi -= (hi > 0 && m_power[hi] < power_value) ? 1 : 0;
+    }
+    else
+    {
+      for(int i = 1; i <= last; ++i)
+      {
+        hi += m_power[i] >= power_value ? 1 : 0;
+      }
+    }
+    const int lo = hi + 1;
+    const double delta = (power_value - m_power[lo]) / (m_power[hi] - m_power[lo]);
+    const double normalized_time = m_times[lo] + delta * (m_times[hi] - m_times[lo]);
+    const double diff = orig_estimate * m_scale - orig_estimate;
+    return orig_estimate + normalized_time * diff;
+  }
+}; // class FixedEstimator
+
+// the built-in curve, normalized at compile time
+constexpr FixedEstimator<PP_DEFAULT_CURVE_SIZE> PP_DEFAULT_ESTIMATOR(PP_DEFAULT_TIMES, PP_DEFAULT_POWER);
+
+template<size_t N>
+inline double max_of(const std::array<double, N> &values)
+{
+  double result = values[0];
+  for(size_t i = 1; i < N; ++i)
+  {
+    result = values[i] > result ? values[i] : result;
+  }
+  return result;
+}
+
+template<size_t N>
+inline double min_of(const std::array<double, N> &values)
+{
+  double result = values[0];
+  for(size_t i = 1; i < N; ++i)
+  {
+    result = values[i] < result ? values[i] : result;
+  }
+  return result;
+}
+
+// lowest index holding value, which must be present
+template<size_t N>
+inline int first_equal(const std::array<double, N> &values, const double value)
+{
+  int i = 0;
+  while(values[i] != value) ++i;
+  return i;
+}
+
+template<int N, int CurveSize>
+struct FixedAllocation
+{
+  static_assert(N > 1, "power can only move between two or more nodes");
+
+  const FixedEstimator<CurveSize> *m_estimator;
+  std::array<double, N> m_orig_estimates;
+  std::array<double, N> m_power_values;
+  std::array<double, N> m_times;
+  // time node i would have after giving away m_donor_inc, infinity
+  // if that takes it below min power
+  std::array<double, N> m_donor_times;
+  double m_donor_inc;
+  double m_initial_runtime;
+
+  FixedAllocation(const FixedEstimator<CurveSize> &estimator,
+                  const double *orig_estimates,
+                  const double ave_power_per_node)
+    : m_estimator(&estimator),
+      m_donor_inc(0)
+  {
+    // clamped to the curve as PowerAllocation::init does: with one
+    // curve the even split level is the average itself
+    const double level = std::max(estimator.get_min_power(), std::min(estimator.get_max_power(), ave_power_per_node));
+    for(int i = 0; i < N; ++i)
+    {
+      m_orig_estimates[i] = orig_estimates[i];
+      m_power_values[i] = level;
+    }
+    update_times();
+    m_initial_runtime = get_max_runtime();
+  }
+
+  void update_times()
+  {
+    for(int i = 0; i < N; ++i)
+    {
+      m_times[i] = m_estimator->estimate(m_power_values[i], m_orig_estimates[i]);
+    }
+    m_donor_inc = 0;
+  }
+
+  double donor_time(const int i) const
+  {
+    const double power = m_power_values[i] - m_donor_inc;
+    if(power < m_estimator->get_min_power())
+    {
+      return std::numeric_limits<double>::infinity();
+    }
+    return m_estimator->estimate(power, m_orig_estimates[i]);
+  }
+
+  void build_donor_times(const double power_inc)
+  {
+    m_donor_inc = power_inc;
+    for(int i = 0; i < N; ++i)
+    {
+      m_donor_times[i] = donor_time(i);
+    }
+  }
+
+  // lowest index with the highest time
+  int get_max_index() const
+  {
+    return first_equal(m_times, max_of(m_times));
+  }
+
+  double get_max_runtime() const
+  {
+    return m_times[get_max_index()];
+  }
+
+  double check_adjustment(const Adjustment &adj) const
+  {
+    double max_value = std::max(
+      m_estimator->estimate(m_power_values[adj.from] - adj.amount, m_orig_estimates[adj.from]),
+      m_estimator->estimate(m_power_values[adj.to] + adj.amount, m_orig_estimates[adj.to]));
+    for(int i = 0; i < N; ++i)
+    {
+      const bool skip = i == adj.from || i == adj.to;
+      max_value = std::max(max_value, skip ? max_value : m_times[i]);
+    }
+    return max_value;
+  }
+
+  void apply_adjustment(const Adjustment &adj)
+  {
+    m_power_values[adj.from] -= adj.amount;
+    m_power_values[adj.to] += adj.amount;
+    m_times[adj.from] = m_estimator->estimate(m_power_values[adj.from], m_orig_estimates[adj.from]);
+    m_times[adj.to] = m_estimator->estimate(m_power_values[adj.to], m_orig_estimates[adj.to]);
+    if(m_donor_inc != 0)
+    {
+      m_donor_times[adj.from] = donor_time(adj.from);
+      m_donor_times[adj.to] = donor_time(adj.to);
+    }
+  }
+}; // struct FixedAllocation
+
+//
+// The greedy of PowerOptimizer::optimize for N nodes on one curve.
+// Each round is a few fixed length scans: the bottleneck, the two
+// highest times among the rest, and the donor with the lowest
+// resulting max.
+//
+template<int N, int CurveSize>
+class FixedOptimizer
+{
+protected:
+  const FixedEstimator<CurveSize> &m_estimator;
+  std::array<double, N> m_orig_estimates;
+public:
+  FixedOptimizer(const FixedEstimator<CurveSize> &e, const double *estimates)
+    : m_estimator(e)
+  {
+    std::copy(estimates, estimates + N, m_orig_estimates.begin());
+  }
+
+  // greedy rounds at a fixed step, returns the number of rounds run
+  int greedy_rounds(FixedAllocation<N, CurveSize> &allocation, const double power_inc) const
+  {
+    if(allocation.m_donor_inc != power_inc)
+    {
+      allocation.build_donor_times(power_inc);
+    }
+    const double inf = std::numeric_limits<double>::infinity();
+    int round = 0;
+    while(true)
+    {
+      const int bottleneck = allocation.get_max_index();
+      if(allocation.m_power_values[bottleneck] + power_inc > m_estimator.get_max_power())
+      {
+        break;
+      }
+      round++;
+      const double new_to = m_estimator.estimate(allocation.m_power_values[bottleneck] + power_inc,
+                                                 allocation.m_orig_estimates[bottleneck]);
+
+      //
+      // Highest and second highest time among the other nodes. Plain
+      // max reductions and a first-match search, which vectorize,
+      // rather than one scan carrying the index along.
+      //
+      std::array<double, N> others = allocation.m_times;
+      others[bottleneck] = -inf;
+      const double first_time = max_of(others);
+      const int first = first_equal(others, first_time);
+      others[first] = -inf;
+      const double second_time = max_of(others);
+
+      // giving from i leaves max(new_to, donor time of i, highest
+      // time of everyone but i and the bottleneck)
+      std::array<double, N> values;
+      for(int i = 0; i < N; ++i)
+      {
+        values[i] = std::max(std::max(new_to, allocation.m_donor_times[i]), first_time);
+      }
+      values[first] = std::max(std::max(new_to, allocation.m_donor_times[first]), second_time);
+      values[bottleneck] = inf;
+      const double best = min_of(values);
+      const int from = best == inf ? -1 : first_equal(values, best);
+      if(from == -1 || !(best < allocation.m_times[bottleneck]))
+      {
+        break;
+      }
+
+      Adjustment adj;
+      adj.to = bottleneck;
+      adj.from = from;
+      adj.amount = power_inc;
+      allocation.apply_adjustment(adj);
+    }
+    return round;
+  }
+
+  FixedAllocation<N, CurveSize> optimize(const double ave_power_per_node, const double power_inc) const
+  {
+    FixedAllocation<N, CurveSize> allocation(m_estimator, m_orig_estimates.data(), ave_power_per_node);
+    greedy_rounds(allocation, power_inc);
+    return allocation;
+  }
+}; // class FixedOptimizer
+
+#endif
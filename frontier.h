@@ -0,0 +1,331 @@
+#ifndef frontier_h
+#define frontier_h
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "estimator.h"
+#include "loader.h"
+
+//
+// Power cap -> runtime frontier of one estimate set. The caps are
+// solved highest first, each one starting from the allocation of the
+// cap above: the watts that no longer fit are taken from the nodes
+// that lose the least time, then the greedy repairs the bottleneck.
+// That costs a few rounds per cap instead of a full solve from the
+// even split.
+//
+// The index is stored as
+//   "PPFRT001" | uint64 caps | uint64 nodes | uint64 key | double power_inc
+//   | caps cap values (descending) | caps even split runtimes
+//   | caps runtimes | caps x nodes power values, one row per cap
+// and mapped read only when loaded. key fingerprints the estimates,
+// curves and classes, so a stale index is rebuilt rather than used.
+//
+static const char PP_FRONTIER_MAGIC[8] = {'P','P','F','R','T','0','0','1'};
+
+struct FrontierHeader
+{
+  char magic[8];
+  uint64_t caps;
+  uint64_t nodes;
+  uint64_t key;
+  double power_inc;
+};
+
+class FrontierIndex
+{
+protected:
+  uint64_t m_key;
+  double m_power_inc;
+  size_t m_nodes;
+  std::vector<double> m_caps;
+  std::vector<double> m_initial_runtimes;
+  std::vector<double> m_runtimes;
+  // caps x nodes, either m_owned_power or the mapped file
+  std::vector<double> m_owned_power;
+  const double *m_power;
+  MappedFile m_file;
+
+  static uint64_t hash_bytes(uint64_t hash, const void *data, const size_t size)
+  {
+    // FNV-1a
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < size; ++i)
+    {
+      hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  //
+  // Move an allocation down to a lower budget: step watts at a time
+  // from the donor whose time grows least (the donor index keyed for
+  // step), the last step only what is left. False if the nodes can't
+  // give enough.
+  //
+  static bool shed_power(PowerAllocation &allocation, double &excess, const double step, const double budget)
+  {
+    if(allocation.m_donor_inc != step)
+    {
+      allocation.build_donor_index(step);
+    }
+    while(excess > 1e-9 * budget)
+    {
+      // on the flat top of a curve the bottleneck itself gets faster
+      // with less power, so it goes first
+      const int bottleneck = allocation.get_max_index();
+      const int from = allocation.m_donor_index.value(bottleneck) < allocation.m_times[bottleneck]
+                         ? bottleneck
+                         : allocation.m_donor_index.winner();
+      const double amount = std::min(step, excess);
+      if(from == -1 || allocation.m_power_values[from] - amount < allocation.get_min_power(from))
+      {
+        return false;
+      }
+      allocation.m_power_values[from] -= amount;
+      allocation.update_node(from);
+      excess -= amount;
+    }
+    return true;
+  }
+
+  //
+  // Coarse to fine, as in PowerOptimizer::optimize_adaptive: while the
+  // drop is more than half a step per node it goes in steps of
+  // power_inc * 2^k, halved down to power_inc for the rest, so a node
+  // gives a few times per cap rather than once per power_inc.
+  //
+  static bool shed_power(PowerAllocation &allocation, const double budget, const double power_inc)
+  {
+    const double size = static_cast<double>(allocation.m_power_values.size());
+    double excess = allocation.get_total_power() - budget;
+    double step = power_inc;
+    while(step * 2 <= excess / size)
+    {
+      step *= 2;
+    }
+    for(; step > power_inc; step /= 2)
+    {
+      double coarse = excess - 0.5 * step * size;
+      if(coarse <= 0)
+      {
+        continue;
+      }
+      // whole steps only, the remainder is left to the finer steps
+      coarse = std::floor(coarse / step) * step;
+      excess -= coarse;
+      if(!shed_power(allocation, coarse, step, budget))
+      {
+        return false;
+      }
+    }
+    return shed_power(allocation, excess, power_inc, budget);
+  }
+
+public:
+  FrontierIndex()
+    : m_key(0),
+      m_power_inc(0),
+      m_nodes(0),
+      m_power(NULL)
+  {
+  }
+
+  // what an index for these inputs must carry to be reused
+  static uint64_t make_key(const Estimator &estimator,
+                           const EstimateView &estimates,
+                           const std::vector<int> &curves)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = hash_bytes(hash, estimates.data(), estimates.size() * sizeof(double));
+    if(!curves.empty())
+    {
+      hash = hash_bytes(hash, &curves[0], curves.size() * sizeof(int));
+    }
+    for(int k = 0; k < estimator.get_num_curves(); ++k)
+    {
+      for(int i = 0; i < estimator.get_curve_size(k); ++i)
+      {
+        const double knot[2] = {estimator.get_curve_power(i, k), estimator.get_curve_time(i, k)};
+        hash = hash_bytes(hash, knot, sizeof(knot));
+      }
+    }
+    return hash;
+  }
+
+  //
+  // Solve every cap with the greedy at power_inc, caps in any order.
+  // A cap the carried allocation can't reach (the nodes are at min
+  // power) is solved from its even split instead.
+  //
+  void build(PowerOptimizer &optimizer,
+             const uint64_t key,
+             std::vector<double> caps,
+             const double power_inc,
+             bool verbose)
+  {
+    std::sort(caps.begin(), caps.end(), std::greater<double>());
+    caps.erase(std::unique(caps.begin(), caps.end()), caps.end());
+    assert(!caps.empty());
+    m_file.close();
+    m_key = key;
+    m_power_inc = power_inc;
+    m_nodes = optimizer.get_estimates().size();
+    m_caps = caps;
+    m_initial_runtimes.resize(caps.size());
+    m_runtimes.resize(caps.size());
+    m_owned_power.resize(caps.size() * m_nodes);
+
+    PowerAllocation allocation = optimizer.optimize(caps[0], power_inc, verbose);
+    for(size_t c = 0; c < caps.size(); ++c)
+    {
+      if(c > 0)
+      {
+        // the even split is only needed for its runtime and budget
+        const PowerAllocation even = optimizer.start_allocation(caps[c]);
+        if(shed_power(allocation, even.get_total_power(), power_inc))
+        {
+          optimizer.greedy_rounds(allocation, power_inc, verbose);
+          allocation.m_initial_runtime = even.m_initial_runtime;
+        }
+        else
+        {
+          allocation = optimizer.optimize(caps[c], power_inc, verbose);
+        }
+      }
+      if(verbose == true)
+      {
+        std::cout<<"Frontier cap "<<caps[c]<<": "<<allocation.get_max_runtime()<<"\n";
+      }
+      m_initial_runtimes[c] = allocation.m_initial_runtime;
+      m_runtimes[c] = allocation.get_max_runtime();
+      std::copy(allocation.m_power_values.begin(), allocation.m_power_values.end(),
+                m_owned_power.begin() + c * m_nodes);
+    }
+    m_power = &m_owned_power[0];
+  }
+
+  bool write(const char *path) const
+  {
+    FILE *out = fopen(path, "wb");
+    if(out == NULL)
+    {
+      std::cerr<<"Error: cannot write "<<path<<"\n";
+      return false;
+    }
+    FrontierHeader header;
+    memcpy(header.magic, PP_FRONTIER_MAGIC, 8);
+    header.caps = m_caps.size();
+    header.nodes = m_nodes;
+    header.key = m_key;
+    header.power_inc = m_power_inc;
+    const size_t caps = m_caps.size();
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(&m_caps[0], sizeof(double), caps, out) == caps;
+    ok = ok && fwrite(&m_initial_runtimes[0], sizeof(double), caps, out) == caps;
+    ok = ok && fwrite(&m_runtimes[0], sizeof(double), caps, out) == caps;
+    ok = ok && fwrite(m_power, sizeof(double), caps * m_nodes, out) == caps * m_nodes;
+    ok = (fclose(out) == 0) && ok;
+    if(!ok)
+    {
+      std::cerr<<"Error: failed writing "<<path<<"\n";
+    }
+    return ok;
+  }
+
+  // false, quietly, if there is no usable index at path
+  bool load(const char *path)
+  {
+    if(access(path, R_OK) != 0 || !m_file.open(path))
+    {
+      return false;
+    }
+    if(m_file.size() < sizeof(FrontierHeader) || memcmp(m_file.data(), PP_FRONTIER_MAGIC, 8) != 0)
+    {
+      std::cerr<<"Error: "<<path<<" is not a frontier index\n";
+      m_file.close();
+      return false;
+    }
+    const FrontierHeader *header = reinterpret_cast<const FrontierHeader*>(m_file.data());
+    const size_t caps = header->caps;
+    const size_t nodes = header->nodes;
+    // by division, so forged counts can't wrap the size check
+    const size_t room = (m_file.size() - sizeof(FrontierHeader)) / sizeof(double);
+    if(caps == 0 || nodes > room || caps > room / (3 + nodes))
+    {
+      std::cerr<<"Error: "<<path<<" is truncated\n";
+      m_file.close();
+      return false;
+    }
+    const double *values = reinterpret_cast<const double*>(m_file.data() + sizeof(FrontierHeader));
+    m_key = header->key;
+    m_power_inc = header->power_inc;
+    m_nodes = nodes;
+    m_caps.assign(values, values + caps);
+    m_initial_runtimes.assign(values + caps, values + 2 * caps);
+    m_runtimes.assign(values + 2 * caps, values + 3 * caps);
+    m_owned_power.clear();
+    m_power = values + 3 * caps;
+    return true;
+  }
+
+  // built from the same inputs and step
+  bool matches(const uint64_t key, const size_t nodes, const double power_inc) const
+  {
+    return m_power != NULL && m_key == key && m_nodes == nodes && m_power_inc == power_inc;
+  }
+
+  const std::vector<double>& get_caps() const
+  {
+    return m_caps;
+  }
+
+  const std::vector<double>& get_runtimes() const
+  {
+    return m_runtimes;
+  }
+
+  const std::vector<double>& get_initial_runtimes() const
+  {
+    return m_initial_runtimes;
+  }
+
+  //
+  // Per-node power at any cap within the frontier: the stored row on
+  // a cap, else the straight line between the rows of the caps on
+  // either side, which spends exactly the budget in between. False if
+  // cap is out of range.
+  //
+  bool lookup(const double cap, std::vector<double> &power) const
+  {
+    if(m_power == NULL || cap > m_caps.front() || cap < m_caps.back())
+    {
+      return false;
+    }
+    // first cap at or below the query, caps are descending
+    const size_t lo = std::lower_bound(m_caps.begin(), m_caps.end(), cap, std::greater<double>()) - m_caps.begin();
+    const double *lo_row = m_power + lo * m_nodes;
+    power.resize(m_nodes);
+    if(m_caps[lo] == cap)
+    {
+      std::copy(lo_row, lo_row + m_nodes, power.begin());
+      return true;
+    }
+    const double *hi_row = lo_row - m_nodes;
+    const double weight = (cap - m_caps[lo]) / (m_caps[lo - 1] - m_caps[lo]);
+    for(size_t i = 0; i < m_nodes; ++i)
+    {
+      power[i] = lo_row[i] + weight * (hi_row[i] - lo_row[i]);
+    }
+    return true;
+  }
+}; // class FrontierIndex
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef hierarchical_h
+#define hierarchical_h
+
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+#include <assert.h>
+
+#include "estimator.h"
+#include "thread_pool.h"
+
+//
+// Two level solve: nodes are split into groups (a rack, a PDU, or a
+// contiguous block of the estimate vector), every group is solved on
+// its own sub-budget in parallel, and a top level pass then moves
+// budget from the group with the most slack to the bottleneck group
+// while that lowers the overall runtime.
+//
+class HierarchicalOptimizer
+{
+protected:
+  struct Group
+  {
+    std::vector<int> m_nodes;       // global node ids
+    std::unique_ptr<PowerOptimizer> m_optimizer;    // over this group's nodes only
+    double m_budget;                // watts given to the group
+    double m_max_budget;            // every node at TDP
+    double m_min_budget;            // every node at min power
+    std::vector<double> m_power;    // solved per-node power
+    double m_runtime;               // solved bottleneck time
+    SolverStats m_stats;            // summed over every solve of the group
+  };
+
+  PowerOptimizer m_flat;
+  std::vector<Group> m_groups;
+  double m_power_range;
+  bool m_is_verbose;
+
+  void solve_group(Group &group, SolverType solver, double power_inc)
+  {
+    const double ave = group.m_budget / group.m_nodes.size();
+    PowerAllocation alloc = group.m_optimizer->solve(solver, ave, power_inc, false);
+    group.m_power = alloc.m_power_values;
+    group.m_runtime = alloc.get_max_runtime();
+    group.m_stats.add(alloc.m_stats);
+  }
+
+public:
+  //
+  // groups holds a group id per node; if it is empty nodes are put in
+  // contiguous blocks of block_size.
+  //
+  HierarchicalOptimizer(Estimator &e,
+                        const EstimateView &estimates,
+                        const std::vector<int> &curves,
+                        const std::vector<int> &groups,
+                        const int block_size,
+                        bool verbose)
+    : m_flat(e, estimates, curves, verbose),
+      m_power_range(e.get_max_power_range()),
+      m_is_verbose(verbose)
+  {
+    const int size = static_cast<int>(estimates.size());
+    assert(groups.empty() || static_cast<int>(groups.size()) == size);
+    assert(!groups.empty() || block_size > 0);
+
+    std::vector<int> group_of(size);
+    int num_groups = 0;
+    for(int i = 0; i < size; ++i)
+    {
+      group_of[i] = groups.empty() ? i / block_size : groups[i];
+      assert(group_of[i] >= 0);
+      num_groups = std::max(num_groups, group_of[i] + 1);
+    }
+
+    std::vector<std::vector<int> > members(num_groups);
+    for(int i = 0; i < size; ++i)
+    {
+      members[group_of[i]].push_back(i);
+    }
+
+    for(int g = 0; g < num_groups; ++g)
+    {
+      if(members[g].empty()) continue;
+      Group group;
+      group.m_nodes = members[g];
+      std::vector<double> sub_estimates;
+      std::vector<int> sub_curves;
+      group.m_max_budget = 0;
+      group.m_min_budget = 0;
+      for(size_t k = 0; k < group.m_nodes.size(); ++k)
+      {
+        const int node = group.m_nodes[k];
+        const int curve = curves.empty() ? 0 : curves[node];
+        sub_estimates.push_back(estimates[node]);
+        if(!curves.empty()) sub_curves.push_back(curve);
+        group.m_max_budget += e.get_max_power(curve);
+        group.m_min_budget += e.get_min_power(curve);
+      }
+      group.m_optimizer.reset(new PowerOptimizer(e, sub_estimates, sub_curves, false));
+      group.m_optimizer->set_quiet(true);
+      group.m_budget = 0;
+      group.m_runtime = 0;
+      m_groups.push_back(std::move(group));
+    }
+  }
+
+  void set_quiet(bool quiet)
+  {
+    m_flat.set_quiet(quiet);
+  }
+
+  void set_timing(bool timing)
+  {
+    m_flat.set_timing(timing);
+    for(size_t g = 0; g < m_groups.size(); ++g)
+    {
+      m_groups[g].m_optimizer->set_timing(timing);
+    }
+  }
+
+  int get_num_groups() const
+  {
+    return static_cast<int>(m_groups.size());
+  }
+
+  //
+  // The result is a PowerAllocation over all nodes, it points into
+  // this object and must not outlive it.
+  //
+  PowerAllocation optimize(SolverType solver,
+                           double ave_power_per_node,
+                           double power_inc,
+                           int threads,
+                           bool verbose)
+  {
+    PowerAllocation allocation = m_flat.start_allocation(ave_power_per_node);
+    const int num_groups = get_num_groups();
+
+    // even sub-budgets, from the (possibly clamped) starting allocation
+    for(int g = 0; g < num_groups; ++g)
+    {
+      Group &group = m_groups[g];
+      group.m_budget = 0;
+      group.m_stats.reset();
+      for(size_t k = 0; k < group.m_nodes.size(); ++k)
+      {
+        group.m_budget += allocation.m_power_values[group.m_nodes[k]];
+      }
+    }
+
+    ThreadPool pool(threads);
+    pool.parallel_for(num_groups, [&](int g)
+    {
+      solve_group(m_groups[g], solver, power_inc);
+    });
+
+    //
+    // Top level: move budget from the group with the lowest bottleneck
+    // to the one with the highest. The amount starts at a quarter of
+    // a power range per node of the smaller group and is halved when
+    // a move does not lower the max of the two, down to power_inc.
+    //
+    int moves = 0;
+    double step = 0;
+    while(num_groups > 1)
+    {
+      int slow = 0;
+      int fast = -1;
+      for(int g = 1; g < num_groups; ++g)
+      {
+        if(m_groups[g].m_runtime > m_groups[slow].m_runtime) slow = g;
+      }
+      for(int g = 0; g < num_groups; ++g)
+      {
+        if(g == slow) continue;
+        if(m_groups[g].m_budget - power_inc < m_groups[g].m_min_budget) continue;
+        if(fast == -1 || m_groups[g].m_runtime < m_groups[fast].m_runtime) fast = g;
+      }
+      if(fast == -1) break;
+
+      Group &to = m_groups[slow];
+      Group &from = m_groups[fast];
+      if(step == 0)
+      {
+        const size_t nodes = std::min(to.m_nodes.size(), from.m_nodes.size());
+        step = std::max(power_inc, 0.25 * nodes * m_power_range);
+      }
+      double amount = std::min(step, to.m_max_budget - to.m_budget);
+      amount = std::min(amount, from.m_budget - from.m_min_budget);
+      if(amount < power_inc)
+      {
+        break;
+      }
+
+      Group *pair[2] = {&to, &from};
+      // the solved state of both, to undo the move
+      double old_budget[2];
+      std::vector<double> old_power[2];
+      double old_runtime[2];
+      for(int k = 0; k < 2; ++k)
+      {
+        old_budget[k] = pair[k]->m_budget;
+        old_power[k] = pair[k]->m_power;
+        old_runtime[k] = pair[k]->m_runtime;
+      }
+      to.m_budget += amount;
+      from.m_budget -= amount;
+      pool.parallel_for(2, [&](int k)
+      {
+        solve_group(*pair[k], solver, power_inc);
+      });
+
+      const double before = old_runtime[0];
+      const double after = std::max(to.m_runtime, from.m_runtime);
+      if(verbose == true)
+      {
+        std::cout<<"---- Move "<<moves<<" ---- "<<amount<<" W from group "<<fast
+                 <<" to "<<slow<<": "<<before<<" -> "<<after<<"\n";
+      }
+      if(after < before)
+      {
+        moves++;
+        continue;
+      }
+      // undo, keeping the work that was spent in the stats
+      for(int k = 0; k < 2; ++k)
+      {
+        pair[k]->m_budget = old_budget[k];
+        pair[k]->m_power.swap(old_power[k]);
+        pair[k]->m_runtime = old_runtime[k];
+      }
+      if(step <= power_inc) break;
+      step = std::max(power_inc, step / 2);
+    }
+
+    std::vector<double> power(allocation.m_power_values.size());
+    for(int g = 0; g < num_groups; ++g)
+    {
+      const Group &group = m_groups[g];
+      for(size_t k = 0; k < group.m_nodes.size(); ++k)
+      {
+        power[group.m_nodes[k]] = group.m_power[k];
+      }
+      allocation.m_stats.add(group.m_stats);
+    }
+    allocation.set_power(power);
+    allocation.m_stats.m_rounds += moves;
+    return allocation;
+  }
+}; // class HierarchicalOptimizer
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef level_optimizer_h
+#define level_optimizer_h
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <assert.h>
+
+#include "estimator.h"
+#include "tournament_tree.h"
+
+//
+// The greedy on integer power levels. Starting from the even split, a
+// node's power only ever moves by whole power_inc steps, so it is
+// start + k * power_inc for a level k within its curve. Every reachable
+// level of every curve class is interpolated once into a table of
+// normalized times, and with a per-node diff = orig * scale - orig a
+// node's time at level k is
+//
+//   orig + table[curve][k] * diff
+//
+// the same expression Estimator::estimate ends with, so times are bit
+// for bit the generic greedy's whenever start + k * power_inc is exact
+// (power_inc a power of two, like 0.5 or 1). Checking and applying a
+// move is a table read and a multiply-add: no segment search, no
+// interpolation, no range branches. Memory is O(N + curves x levels).
+//
+class LevelTable
+{
+protected:
+  double m_power_inc;
+  // per curve class: the start power and its level, and normalized
+  // time at every level from min to max power
+  std::vector<double> m_start_power;
+  std::vector<int> m_start;
+  std::vector<std::vector<double> > m_norm_times;
+  std::vector<double> m_scale;
+public:
+  // level as Estimator::get_even_split_level gives it
+  LevelTable(const Estimator &estimator, const double level, const double power_inc)
+    : m_power_inc(power_inc)
+  {
+    assert(power_inc > 0);
+    const int curves = estimator.get_num_curves();
+    m_start_power.resize(curves);
+    m_start.resize(curves);
+    m_norm_times.resize(curves);
+    m_scale.resize(curves);
+    for(int c = 0; c < curves; ++c)
+    {
+      // nodes start clamped to their curve, as in PowerAllocation::init
+      const double min_power = estimator.get_min_power(c);
+      const double max_power = estimator.get_max_power(c);
+      const double start = std::max(min_power, std::min(max_power, level));
+      int below = 0;
+      while(start - (below + 1) * power_inc >= min_power) below++;
+      int above = 0;
+      while(start + (above + 1) * power_inc <= max_power) above++;
+      m_start[c] = below;
+      m_start_power[c] = start;
+      m_norm_times[c].resize(below + above + 1);
+      for(int k = 0; k <= below + above; ++k)
+      {
+        m_norm_times[c][k] = estimator.get_normalized_time(power(c, k), c);
+      }
+      m_scale[c] = estimator.get_time_scale(c);
+    }
+  }
+
+  double get_power_inc() const
+  {
+    return m_power_inc;
+  }
+
+  int get_start_level(const int curve) const
+  {
+    return m_start[curve];
+  }
+
+  int get_num_levels(const int curve) const
+  {
+    return static_cast<int>(m_norm_times[curve].size());
+  }
+
+  double power(const int curve, const int level) const
+  {
+    return m_start_power[curve] + (level - m_start[curve]) * m_power_inc;
+  }
+
+  double get_scale(const int curve) const
+  {
+    return m_scale[curve];
+  }
+
+  const double* get_norm_times(const int curve) const
+  {
+    return &m_norm_times[curve][0];
+  }
+}; // class LevelTable
+
+struct LevelAllocation
+{
+  const LevelTable *m_table;
+  // borrowed, as in PowerAllocation; curves NULL for all class 0
+  const double *m_orig_estimates;
+  const int *m_curves;
+  std::vector<double> m_diffs;
+  // normalized time table of each node's curve
+  std::vector<const double*> m_norm_times;
+  std::vector<int> m_levels;
+  std::vector<int> m_max_levels;
+  std::vector<double> m_times;
+  // the same trees as PowerAllocation, donors keyed one level down
+  MaxTree m_time_index;
+  MinTree m_donor_index;
+  double m_initial_runtime;
+
+  // estimates and curves must outlive the allocation
+  LevelAllocation(const LevelTable &table, const EstimateView &estimates, const std::vector<int> &curves)
+    : m_table(&table),
+      m_orig_estimates(estimates.data()),
+      m_curves(curves.empty() ? NULL : &curves[0])
+  {
+    const int size = static_cast<int>(estimates.size());
+    assert(curves.empty() || static_cast<int>(curves.size()) == size);
+    m_diffs.resize(size);
+    m_norm_times.resize(size);
+    m_levels.resize(size);
+    m_max_levels.resize(size);
+    m_times.resize(size);
+    std::vector<double> donor_keys(size);
+    for(int i = 0; i < size; ++i)
+    {
+      const int curve = get_curve(i);
+      const double orig = m_orig_estimates[i];
+      m_diffs[i] = orig * table.get_scale(curve) - orig;
+      m_norm_times[i] = table.get_norm_times(curve);
+      m_levels[i] = table.get_start_level(curve);
+      m_max_levels[i] = table.get_num_levels(curve) - 1;
+      m_times[i] = time_at(i, m_levels[i]);
+      donor_keys[i] = donor_key(i);
+    }
+    m_time_index.build(m_times);
+    m_donor_index.build(donor_keys);
+    m_initial_runtime = get_max_runtime();
+  }
+
+  int get_curve(const int node) const
+  {
+    return m_curves == NULL ? 0 : m_curves[node];
+  }
+
+  double time_at(const int node, const int level) const
+  {
+    return m_orig_estimates[node] + m_norm_times[node][level] * m_diffs[node];
+  }
+
+  // time one level down, infinity at the lowest level
+  double donor_key(const int node) const
+  {
+    return m_levels[node] > 0 ? time_at(node, m_levels[node] - 1) : std::numeric_limits<double>::infinity();
+  }
+
+  int get_max_index() const
+  {
+    return m_time_index.winner();
+  }
+
+  double get_max_runtime() const
+  {
+    return m_times[get_max_index()];
+  }
+
+  // one level from adj.from to adj.to, adj.amount is ignored
+  void apply_adjustment(const Adjustment &adj)
+  {
+    m_levels[adj.from]--;
+    m_levels[adj.to]++;
+    const int nodes[2] = {adj.from, adj.to};
+    for(int k = 0; k < 2; ++k)
+    {
+      const int node = nodes[k];
+      m_times[node] = time_at(node, m_levels[node]);
+      m_time_index.update(node, m_times[node]);
+      m_donor_index.update(node, donor_key(node));
+    }
+  }
+
+  std::vector<double> get_power() const
+  {
+    std::vector<double> power(m_levels.size());
+    for(size_t i = 0; i < m_levels.size(); ++i)
+    {
+      power[i] = m_table->power(get_curve(static_cast<int>(i)), m_levels[i]);
+    }
+    return power;
+  }
+}; // struct LevelAllocation
+
+//
+// PowerOptimizer::greedy_rounds on levels: the same bottleneck, donor
+// choice (pick_greedy_donor) and tie breaking.
+//
+class LevelOptimizer
+{
+protected:
+  LevelTable m_table;
+
+  static int pick_donor(const LevelAllocation &allocation, const int bottleneck_idx)
+  {
+    return pick_greedy_donor(allocation.m_time_index, allocation.m_donor_index, allocation.m_times,
+                             bottleneck_idx,
+                             [&]() { return allocation.time_at(bottleneck_idx,
+                                                               allocation.m_levels[bottleneck_idx] + 1); },
+                             NULL);
+  }
+
+public:
+  // the table for these nodes; curves empty for all class 0. Solve
+  // with a LevelAllocation over the same estimates and curves.
+  LevelOptimizer(const Estimator &estimator,
+                 const EstimateView &estimates,
+                 const std::vector<int> &curves,
+                 const double ave_power_per_node,
+                 const double power_inc)
+    : m_table(estimator,
+              estimator.get_even_split_level(ave_power_per_node, curves.empty() ? NULL : &curves[0],
+                                             static_cast<int>(estimates.size())),
+              power_inc)
+  {
+  }
+
+  const LevelTable& get_table() const
+  {
+    return m_table;
+  }
+
+  // greedy rounds until no one level move helps, returns the rounds run
+  int greedy_rounds(LevelAllocation &allocation) const
+  {
+    int round = 0;
+    while(true)
+    {
+      const int bottleneck_idx = allocation.get_max_index();
+      if(allocation.m_levels[bottleneck_idx] >= allocation.m_max_levels[bottleneck_idx])
+      {
+        break;
+      }
+      round++;
+      const int from = pick_donor(allocation, bottleneck_idx);
+      if(from == -1)
+      {
+        break;
+      }
+      Adjustment adj;
+      adj.to = bottleneck_idx;
+      adj.from = from;
+      adj.amount = m_table.get_power_inc();
+      allocation.apply_adjustment(adj);
+    }
+    return round;
+  }
+}; // class LevelOptimizer
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef loader_h
+#define loader_h
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//
+// Estimates and power/time curves can be read from two formats:
+//
+//  text   - numbers separated by commas and/or white space, as in
+//           conf_prediction/*/conf*.txt. A curve file holds
+//           "power, time" pairs, highest power first.
+//
+//  binary - a 16 byte header followed by raw native doubles, so the
+//           values can be used straight out of an mmap'ed file:
+//             estimates: "PPEST001" | uint64 count | count doubles
+//             curve:     "PPCRV001" | uint64 count | count power
+//                                                  | count times
+//             caps:      "PPCAP001" | uint64 count | count doubles
+//           The caps file is the per-node power cap vector written
+//           by the binary output mode (see output.h). Frontier
+//           indexes ("PPFRT001") are described in frontier.h.
+//
+static const char PP_ESTIMATE_MAGIC[8] = {'P','P','E','S','T','0','0','1'};
+static const char PP_CURVE_MAGIC[8]    = {'P','P','C','R','V','0','0','1'};
+static const char PP_CAP_MAGIC[8]      = {'P','P','C','A','P','0','0','1'};
+
+struct BinaryHeader
+{
+  char magic[8];
+  uint64_t count;
+};
+
+//
+// Read only memory map of a whole file. Not copyable, the mapping
+// is released when the object goes away.
+//
+class MappedFile
+{
+protected:
+  void *m_data;
+  size_t m_size;
+
+  MappedFile(const MappedFile &);
+  MappedFile& operator=(const MappedFile &);
+public:
+  MappedFile()
+    : m_data(NULL),
+      m_size(0)
+  {
+  }
+
+  ~MappedFile()
+  {
+    close();
+  }
+
+  bool open(const char *path)
+  {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if(fd == -1)
+    {
+      std::cerr<<"Error: cannot open "<<path<<"\n";
+      return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+      std::cerr<<"Error: cannot stat "<<path<<"\n";
+      ::close(fd);
+      return false;
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    if(m_size > 0)
+    {
+      m_data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(m_data == MAP_FAILED)
+      {
+        std::cerr<<"Error: cannot mmap "<<path<<"\n";
+        m_data = NULL;
+        m_size = 0;
+        ::close(fd);
+        return false;
+      }
+    }
+    ::close(fd);
+    return true;
+  }
+
+  void close()
+  {
+    if(m_data != NULL)
+    {
+      munmap(m_data, m_size);
+    }
+    m_data = NULL;
+    m_size = 0;
+  }
+
+  const char* data() const
+  {
+    return static_cast<const char*>(m_data);
+  }
+
+  size_t size() const
+  {
+    return m_size;
+  }
+}; // class MappedFile
+
+inline bool has_magic(const MappedFile &file, const char *magic)
+{
+  return file.size() >= sizeof(BinaryHeader) &&
+         memcmp(file.data(), magic, 8) == 0;
+}
+
+//
+// Pull every number out of a text buffer. Commas and white space are
+// both treated as separators.
+//
+inline bool parse_numbers(const char *begin,
+                          const char *end,
+                          std::vector<double> &values,
+                          const char *path)
+{
+  values.clear();
+  // strtod needs a terminated string, copy once into a buffer
+  std::string buffer(begin, end);
+  const char *pos = buffer.c_str();
+  while(*pos != '\0')
+  {
+    if(*pos == ',' || *pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r')
+    {
+      pos++;
+      continue;
+    }
+    char *next = NULL;
+    double val = strtod(pos, &next);
+    if(next == pos)
+    {
+      std::cerr<<"Error: bad number in "<<path<<" at offset "<<(pos - buffer.c_str())<<"\n";
+      return false;
+    }
+    values.push_back(val);
+    pos = next;
+  }
+  return true;
+}
+
+//
+// Estimates backed either by an mmap'ed binary file (no copy) or by
+// values parsed from a text file.
+//
+class EstimateSource
+{
+protected:
+  MappedFile m_file;
+  std::vector<double> m_parsed;
+  const double *m_data;
+  size_t m_size;
+public:
+  EstimateSource()
+    : m_data(NULL),
+      m_size(0)
+  {
+  }
+
+  bool load(const char *path)
+  {
+    m_data = NULL;
+    m_size = 0;
+    m_parsed.clear();
+    if(!m_file.open(path)) return false;
+
+    if(has_magic(m_file, PP_ESTIMATE_MAGIC))
+    {
+      const BinaryHeader *header = reinterpret_cast<const BinaryHeader*>(m_file.data());
+      // has_magic checked the header fits; divide so a forged count can't wrap
+      if(header->count > (m_file.size() - sizeof(BinaryHeader)) / sizeof(double))
+      {
+        std::cerr<<"Error: truncated estimate file "<<path<<"\n";
+        return false;
+      }
+      m_data = reinterpret_cast<const double*>(m_file.data() + sizeof(BinaryHeader));
+      m_size = static_cast<size_t>(header->count);
+      return true;
+    }
+
+    if(!parse_numbers(m_file.data(), m_file.data() + m_file.size(), m_parsed, path))
+    {
+      return false;
+    }
+    m_file.close();
+    m_data = m_parsed.empty() ? NULL : &m_parsed[0];
+    m_size = m_parsed.size();
+    return true;
+  }
+
+  const double* data() const
+  {
+    return m_data;
+  }
+
+  size_t size() const
+  {
+    return m_size;
+  }
+
+  std::vector<double> to_vector() const
+  {
+    return std::vector<double>(m_data, m_data + m_size);
+  }
+}; // class EstimateSource
+
+//
+// A power/time curve in the layout Estimator expects:
+// power[0] highest and power[n-1] lowest
+//
+struct PowerCurve
+{
+  std::vector<double> m_power;
+  std::vector<double> m_times;
+
+  //
+  // Just the "power, time" pairs of a text or binary curve file, also
+  // the format of measured samples (see Estimator::add_samples).
+  //
+  bool load_pairs(const char *path)
+  {
+    MappedFile file;
+    if(!file.open(path)) return false;
+    m_power.clear();
+    m_times.clear();
+
+    if(has_magic(file, PP_CURVE_MAGIC))
+    {
+      const BinaryHeader *header = reinterpret_cast<const BinaryHeader*>(file.data());
+      const size_t count = static_cast<size_t>(header->count);
+      if(count > (file.size() - sizeof(BinaryHeader)) / (2 * sizeof(double)))
+      {
+        std::cerr<<"Error: truncated curve file "<<path<<"\n";
+        return false;
+      }
+      const double *vals = reinterpret_cast<const double*>(file.data() + sizeof(BinaryHeader));
+      m_power.assign(vals, vals + count);
+      m_times.assign(vals + count, vals + 2 * count);
+    }
+    else
+    {
+      std::vector<double> values;
+      if(!parse_numbers(file.data(), file.data() + file.size(), values, path))
+      {
+        return false;
+      }
+      if(values.size() % 2 != 0)
+      {
+        std::cerr<<"Error: curve file "<<path<<" needs power, time pairs\n";
+        return false;
+      }
+      const size_t count = values.size() / 2;
+      m_power.resize(count);
+      m_times.resize(count);
+      for(size_t i = 0; i < count; ++i)
+      {
+        m_power[i] = values[2 * i];
+        m_times[i] = values[2 * i + 1];
+      }
+    }
+    return true;
+  }
+
+  bool load(const char *path)
+  {
+    if(!load_pairs(path))
+    {
+      return false;
+    }
+    if(m_power.size() < 2)
+    {
+      std::cerr<<"Error: curve file "<<path<<" needs at least two points\n";
+      return false;
+    }
+    return true;
+  }
+
+  int size() const
+  {
+    return static_cast<int>(m_power.size());
+  }
+}; // struct PowerCurve
+
+inline bool write_binary(const char *path,
+                         const char *magic,
+                         const double *first,
+                         const double *second,
+                         const size_t count)
+{
+  FILE *out = fopen(path, "wb");
+  if(out == NULL)
+  {
+    std::cerr<<"Error: cannot write "<<path<<"\n";
+    return false;
+  }
+  BinaryHeader header;
+  memcpy(header.magic, magic, 8);
+  header.count = count;
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+  ok = ok && fwrite(first, sizeof(double), count, out) == count;
+  if(second != NULL)
+  {
+    ok = ok && fwrite(second, sizeof(double), count, out) == count;
+  }
+  ok = (fclose(out) == 0) && ok;
+  if(!ok)
+  {
+    std::cerr<<"Error: failed writing "<<path<<"\n";
+  }
+  return ok;
+}
+
+inline bool write_estimates_binary(const char *path, const double *estimates, const size_t count)
+{
+  return write_binary(path, PP_ESTIMATE_MAGIC, estimates, NULL, count);
+}
+
+inline bool write_curve_binary(const char *path, const PowerCurve &curve)
+{
+  return write_binary(path, PP_CURVE_MAGIC, &curve.m_power[0], &curve.m_times[0], curve.m_power.size());
+}
+
+#endif
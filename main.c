@@ -1,8 +1,160 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <string.h>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <memory>
 
 #include "estimator.h"
+#include "loader.h"
+#include "sweep.h"
+#include "output.h"
+#include "hierarchical.h"
+#include "robust.h"
+#include "multi_job.h"
+#include "fixed_optimizer.h"
+#include "server.h"
+#include "frontier.h"
+#include "energy.h"
+#include "level_optimizer.h"
+#include "refine.h"
+
+// split a comma separated option value
+static std::vector<std::string> split_list(const char *list)
+{
+  std::vector<std::string> items;
+  std::stringstream str(list);
+  std::string item;
+  while(std::getline(str, item, ','))
+  {
+    if(!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+//
+// Load the estimates named by -f, or by -n/-c under data_dir.
+// est_size <= 0 accepts any number of estimates.
+//
+static bool load_estimates(const char *est_file,
+                           const char *data_dir,
+                           const int est_size,
+                           const char *config,
+                           EstimateSource &source)
+{
+  std::string est_path;
+  if(est_file != NULL)
+  {
+    est_path = est_file;
+  }
+  else
+  {
+    std::ostringstream path;
+    path<<data_dir<<"/"<<est_size<<"nodes/conf"<<config<<".txt";
+    est_path = path.str();
+  }
+
+  if(!source.load(est_path.c_str()))
+  {
+    std::cerr<<"Error: unknown configuration "<<est_path<<"\n";
+    return false;
+  }
+  if(est_size > 0 && static_cast<int>(source.size()) != est_size)
+  {
+    std::cerr<<"Error: expected "<<est_size<<" estimates in "<<est_path
+             <<" but found "<<source.size()<<"\n";
+    return false;
+  }
+  if(source.size() == 0)
+  {
+    std::cerr<<"Error: no estimates in "<<est_path<<"\n";
+    return false;
+  }
+  return true;
+}
+
+template<int N>
+static void solve_fixed_size(const EstimateView &estimates,
+                             const double ave_power_per_node,
+                             const double power_inc,
+                             std::vector<double> &power)
+{
+  FixedOptimizer<N, PP_DEFAULT_CURVE_SIZE> optimizer(PP_DEFAULT_ESTIMATOR, estimates.data());
+  const FixedAllocation<N, PP_DEFAULT_CURVE_SIZE> alloc = optimizer.optimize(ave_power_per_node, power_inc);
+  power.assign(alloc.m_power_values.begin(), alloc.m_power_values.end());
+}
+
+//
+// Greedy solve on the built-in curve with the compile time kernel.
+// Only the 8 node jobs use it: at 64 nodes the O(N) scans per round
+// are no faster than the tournament trees (see the repeat rows of
+// make bench). false if there is no kernel for this many estimates.
+//
+static bool solve_fixed(const EstimateView &estimates,
+                        const double ave_power_per_node,
+                        const double power_inc,
+                        std::vector<double> &power)
+{
+  switch(estimates.size())
+  {
+    case 8:
+      solve_fixed_size<8>(estimates, ave_power_per_node, power_inc, power);
+      return true;
+  }
+  return false;
+}
+
+// greedy on integer power levels, returns the rounds run
+static int solve_levels(const Estimator &estimator,
+                        const EstimateView &estimates,
+                        const std::vector<int> &curves,
+                        const double ave_power_per_node,
+                        const double power_inc,
+                        std::vector<double> &power)
+{
+  const LevelOptimizer optimizer(estimator, estimates, curves, ave_power_per_node, power_inc);
+  LevelAllocation alloc(optimizer.get_table(), estimates, curves);
+  const int rounds = optimizer.greedy_rounds(alloc);
+  power = alloc.get_power();
+  return rounds;
+}
+
+// write an allocation to out_file, or stdout when it is NULL
+static bool write_result(const char *out_file, const PowerAllocation &alloc, const OutputFormat format)
+{
+  if(out_file == NULL)
+  {
+    write_allocation(std::cout, alloc, format);
+    return true;
+  }
+  std::ofstream out(out_file, std::ios::out | std::ios::binary);
+  if(!out)
+  {
+    std::cerr<<"Error: cannot write "<<out_file<<"\n";
+    return false;
+  }
+  write_allocation(out, alloc, format);
+  return true;
+}
+
+// write solver counters as JSON to a file, or stdout for "-"
+static bool write_stats(const char *stats_file, const SolverStats &stats)
+{
+  if(strcmp(stats_file, "-") == 0)
+  {
+    stats.print_json(std::cout);
+    return true;
+  }
+  std::ofstream out(stats_file);
+  if(!out)
+  {
+    std::cerr<<"Error: cannot write "<<stats_file<<"\n";
+    return false;
+  }
+  stats.print_json(out);
+  return true;
+}
 
 int main(int argc, char** argv)
 {
@@ -10,7 +162,18 @@ int main(int argc, char** argv)
                       "NAME\n"
                       "  power_play - Best power scheduling strategy.\n"
                       "SYNOPSIS\n"
-                      "  %s [--help | -h] [-i power_incr] [-p avg_pow_per_node] [-v]\n"
+                      "  %s [--help | -h] -i power_incr -p avg_pow_per_node\n"
+                      "     (-n est_size -c config | -f est_file) [-t curve_file]... [-r samples_file]... [-k class_file]\n"
+                      "     [-d data_dir] [-J stats_file] [-o format] [-O out_file] [-v]\n"
+                      "     [-w est_out] [-W curve_out] [-g group_size | -G group_file] [-j threads]\n"
+                      "     [-u sigma [-U scenarios] [-q percentile] | -e max_slowdown] [-R starts [-T budget_ms]]\n"
+                      "  %s -i power_incr -F index_file [-p avg_pow_per_node] [-s cap1,cap2,...]\n"
+                      "     (-n est_size -c config | -f est_file) [-t curve_file]... [-k class_file]\n"
+                      "  %s -i power_incr -s cap1,cap2,... (-n est_size -c A,B,... | -f est_file)\n"
+                      "     [-j threads] [-t curve_file] [-d data_dir]\n"
+                      "  %s -S socket_path [-t curve_file]... [-k class_file] [-n est_size -c config | -f est_file]\n"
+                      "  %s -i power_incr (-p avg_pow_per_node | -b budget) -m est_file1,est_file2,...\n"
+                      "     [-K class1,class2,...] [-x max|sum] [-j threads] [-t curve_file]... [-J stats_file]\n"
                       "OPTIONS\n"
                       "  --help | -h\n"
                       "     Display this help information, then exit.\n"
@@ -20,31 +183,143 @@ int main(int argc, char** argv)
                       "     Power per node.\n"
                       "  -v\n"
                       "     Verbose output.\n"
+                      "  -o format\n"
+                      "     table (default): per-node table before and after solving.\n"
+                      "     csv: node,power,time,estimate,curve rows of the result.\n"
+                      "     binary: per-node power caps (PPCAP001 header + doubles).\n"
+                      "     summary: only the two Runtime: lines (even split, solved).\n"
+                      "  -O out_file\n"
+                      "     Write the result there instead of stdout.\n"
+                      "  -J stats_file\n"
+                      "     Time the solver phases and write its counters as JSON (- for stdout).\n"
                       "  -n est_size\n"
                       "     Number of estimates.\n"
                       "  -c config\n"
-                      "     Letter of config.\n"
+                      "     Letter of config, read from data_dir/<est_size>nodes/conf<config>.txt.\n"
+                      "  -d data_dir\n"
+                      "     Directory holding the configs (default conf_prediction).\n"
+                      "  -f est_file\n"
+                      "     Estimates file, text (comma separated) or binary.\n"
+                      "  -t curve_file\n"
+                      "     Power/time curve file, text (power, time pairs) or binary.\n"
+                      "     Repeat to add curve classes 1, 2, ... after class 0.\n"
+                      "  -r samples_file\n"
+                      "     Measured power, runtime pairs (curve file format, runtimes in the\n"
+                      "     curve's units) folded into the curve before solving. Repeat to\n"
+                      "     refine curve classes 1, 2, ... after class 0.\n"
+                      "  -k class_file\n"
+                      "     Curve class of every node (text or binary), default all class 0.\n"
+                      "  -w est_out\n"
+                      "     Write the estimates in binary form, then exit.\n"
+                      "  -W curve_out\n"
+                      "     Write the power/time curve in binary form, then exit.\n"
+                      "  -s cap1,cap2,...\n"
+                      "     Sweep mode: solve every config (-c may list several) at every\n"
+                      "     power cap and print the n_ests conf pow old_time paviz_time\n"
+                      "     speedup table.\n"
+                      "  -e max_slowdown\n"
+                      "     Energy mode: the plan with the least power x runtime that is at most\n"
+                      "     max_slowdown (e.g. 0.05) slower than the solver's. 0 keeps the\n"
+                      "     runtime and only gives back watts that don't help. Prints the\n"
+                      "     energy of both plans and the power released from the budget.\n"
+                      "  -R starts\n"
+                      "     Refine the solved plan by local search: moves of several power_incr\n"
+                      "     at once to up to four of the slowest nodes, after which the greedy\n"
+                      "     finishes. Start 0 refines the plan itself, the others a randomly\n"
+                      "     shaken copy; the fastest plan is kept. Prints both runtimes.\n"
+                      "  -T budget_ms\n"
+                      "     Time budget of -R in milliseconds (default 1000).\n"
+                      "  -F index_file\n"
+                      "     Frontier mode: solve the caps of -s (default every whole watt from\n"
+                      "     max to min power) highest first, each from the plan of the cap\n"
+                      "     above, and store cap, runtime and per-node power in index_file. A\n"
+                      "     matching index from an earlier run (same estimates, curves,\n"
+                      "     classes and -i) is reused. With -p the plan at that cap is looked\n"
+                      "     up, interpolated between the neighbouring caps and finished by the\n"
+                      "     greedy; without it the frontier is printed as the -s table.\n"
+                      "  -g group_size\n"
+                      "     Hierarchical mode: solve contiguous blocks of group_size nodes in\n"
+                      "     parallel, then move budget between the blocks.\n"
+                      "  -G group_file\n"
+                      "     Hierarchical mode with the group (rack, PDU) of every node read\n"
+                      "     from a file (text or binary), numbered from 0.\n"
+                      "  -j threads\n"
+                      "     Threads used by sweep, hierarchical, robust and refine mode (default all\n"
+                      "     hardware threads).\n"
+                      "  -u sigma\n"
+                      "     Robust mode: score plans against perturbed estimates (lognormal,\n"
+                      "     relative spread sigma, e.g. 0.1) and move power towards the nodes\n"
+                      "     that are most often the bottleneck, while that lowers the score.\n"
+                      "  -U scenarios\n"
+                      "     Perturbed estimate vectors for -u (default 1000).\n"
+                      "  -q percentile\n"
+                      "     Score by this percentile of the max runtime, e.g. 95, instead of\n"
+                      "     the mean over the scenarios (0, the default).\n"
+                      "  -m est_file1,est_file2,...\n"
+                      "     Multi-job mode: one estimates file per job, all sharing the cluster\n"
+                      "     budget (-b watts, or -p times the total number of nodes). Prints\n"
+                      "     the budget, runtimes and slowdown (runtime / fastest runtime) per job.\n"
+                      "  -K class1,class2,...\n"
+                      "     Curve class of every node of each job in -m, default class 0.\n"
+                      "  -b budget\n"
+                      "     Cluster power budget in watts for -m.\n"
+                      "  -x objective\n"
+                      "     max (default): lowest maximum slowdown over the jobs in -m.\n"
+                      "     sum: lowest sum of slowdowns.\n"
+                      "  -S socket_path\n"
+                      "     Server mode: keep the curves and estimates resident and answer\n"
+                      "     line requests (set, load, update, alloc, sample, stats, quit; see\n"
+                      "     server.h) on a Unix domain socket, or on stdin/stdout for -.\n"
+                      "  -a solver\n"
+                      "     greedy (default): move power_incr watts to the bottleneck per round.\n"
+                      "     adaptive: greedy with large steps halved down to power_incr.\n"
+                      "     water: bisect on the target runtime, power_incr is not used.\n"
+                      "     levels: the greedy on precomputed per-level time tables, same\n"
+                      "     result (exactly, for power_incr a power of two); the single\n"
+                      "     flat solve only, not with -s, -F, -m, -g, -G, -u or -e.\n"
                       "\n";
   if(argc == 1 || argc > 1 && (
              strncmp(argv[1], "--help", strlen("--help")) == 0 ||
              strncmp(argv[1], "-h", strlen("-h")) == 0))
   {
-    printf(usage, argv[0]);
+    printf(usage, argv[0], argv[0], argv[0], argv[0], argv[0]);
     return EXIT_SUCCESS;
   }
-  if(argc < 9)
-  {
-    printf(usage, argv[0]);
-    return EXIT_FAILURE;
-  }
-
   int opt;
-  double power_inc;
-  double ave_power_per_node;
+  double power_inc = 0;
+  double ave_power_per_node = 0;
   bool is_verbose = false;
-  int est_size;
+  int est_size = 0;
   char *config = NULL;
-  while((opt = getopt(argc, argv, "i:p:vn:c:")) != -1)
+  const char *data_dir = "conf_prediction";
+  char *est_file = NULL;
+  std::vector<char*> curve_files;
+  std::vector<char*> sample_files;
+  char *class_file = NULL;
+  char *stats_file = NULL;
+  OutputFormat format = OUTPUT_TABLE;
+  char *out_file = NULL;
+  char *est_out = NULL;
+  char *curve_out = NULL;
+  char *power_caps = NULL;
+  int threads = 0;
+  int group_size = 0;
+  char *group_file = NULL;
+  char *server_path = NULL;
+  char *frontier_file = NULL;
+  char *job_files = NULL;
+  char *job_classes = NULL;
+  double budget = 0;
+  JobObjective objective = MAX_SLOWDOWN;
+  double sigma = 0;
+  int scenarios = 1000;
+  double percentile = 0;
+  double max_slowdown = -1;
+  int refine_starts = 0;
+  double refine_budget = 1000;
+  SolverType solver = GREEDY;
+  bool use_levels = false;
+  while((opt = getopt(argc, argv, "i:p:vn:c:d:f:t:r:k:w:W:s:j:a:J:o:O:g:G:m:K:b:x:S:u:U:q:F:e:R:T:")) != -1)
   {
     switch(opt)
     {
@@ -63,174 +338,572 @@ int main(int argc, char** argv)
       case 'c':
         config = optarg;
         break;
+      case 'o':
+        if(!parse_output_format(optarg, format))
+        {
+          std::cerr<<"Error: unknown output format "<<optarg<<"\n";
+          printf(usage, argv[0], argv[0], argv[0], argv[0], argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'O':
+        out_file = optarg;
+        break;
+      case 'J':
+        stats_file = optarg;
+        break;
+      case 'k':
+        class_file = optarg;
+        break;
+      case 'd':
+        data_dir = optarg;
+        break;
+      case 'f':
+        est_file = optarg;
+        break;
+      case 't':
+        curve_files.push_back(optarg);
+        break;
+      case 'r':
+        sample_files.push_back(optarg);
+        break;
+      case 'w':
+        est_out = optarg;
+        break;
+      case 'W':
+        curve_out = optarg;
+        break;
+      case 's':
+        power_caps = optarg;
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'g':
+        group_size = atoi(optarg);
+        break;
+      case 'G':
+        group_file = optarg;
+        break;
+      case 'S':
+        server_path = optarg;
+        break;
+      case 'e':
+        max_slowdown = atof(optarg);
+        break;
+      case 'R':
+        refine_starts = atoi(optarg);
+        break;
+      case 'T':
+        refine_budget = atof(optarg);
+        break;
+      case 'F':
+        frontier_file = optarg;
+        break;
+      case 'u':
+        sigma = atof(optarg);
+        break;
+      case 'U':
+        scenarios = atoi(optarg);
+        break;
+      case 'q':
+        percentile = atof(optarg);
+        break;
+      case 'm':
+        job_files = optarg;
+        break;
+      case 'K':
+        job_classes = optarg;
+        break;
+      case 'b':
+        budget = atof(optarg);
+        break;
+      case 'x':
+        if(!parse_job_objective(optarg, objective))
+        {
+          std::cerr<<"Error: unknown objective "<<optarg<<"\n";
+          printf(usage, argv[0], argv[0], argv[0], argv[0], argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'a':
+        if(strcmp(optarg, "greedy") == 0)
+        {
+          solver = GREEDY;
+        }
+        else if(strcmp(optarg, "adaptive") == 0)
+        {
+          solver = ADAPTIVE;
+        }
+        else if(strcmp(optarg, "water") == 0)
+        {
+          solver = WATER_FILL;
+        }
+        else if(strcmp(optarg, "levels") == 0)
+        {
+          solver = GREEDY;
+          use_levels = true;
+        }
+        else
+        {
+          std::cerr<<"Error: unknown solver "<<optarg<<"\n";
+          printf(usage, argv[0], argv[0], argv[0], argv[0], argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
       default:
         std::cerr<<"Error: unknown parameter\n";
-        printf(usage, argv[0]);
+        printf(usage, argv[0], argv[0], argv[0], argv[0], argv[0]);
         return EXIT_FAILURE;
     }
   }
 
-  const static int size = 52;
-  double power[size] = {115, 114, 113, 112, 111, 
-                        110, 109, 108, 107, 106, 
-                        105, 104, 103, 102, 101, 
-                        100, 99, 98, 97, 96,
-                        95, 94, 93, 92, 91,
-                        90, 89, 88, 87, 86, 
-                        85, 84, 83, 82, 81,
-                        80, 79, 78, 77, 76,
-                        75, 74, 73, 72, 71, 
-                        70, 69, 68, 67, 66,
-                        65, 64};
-
-  double times[size] = {163.21, 163.133, 162.991, 163.239, 163.555,
-                        163.328, 163, 162.979, 163.467, 163.007,
-                        163.251, 163.172, 163.508, 163.237, 163.148, 
-                        163.04, 163.96, 165.358, 165.717, 166.549, 
-                        167.118, 167.887, 168.771, 170.231, 171.461,
-                        172.481, 173.051, 173.822, 174.663, 176.108,
-                        176.753, 178.275, 179.087, 180.204, 181.856,
-                        183.431, 184.244, 185.467, 186.802, 188.932,
-                        191.233, 192.752, 195.378, 198.025, 201.18,
-                        204.024, 208.127, 211.4, 215.313, 219.024,
-                        223.137, 227.409};
-
-  if (est_size == 8)
-  {
-    if(strcmp(config, "A") == 0)
-    {
-      double ests[est_size] = {1.40017, 0.298057, 1.4095, 0.315991, 1.41141, 0.316148, 1.42095, 0.646492};
-      std::vector<double> estimates(est_size);
-      for(int i = 0; i < est_size; ++i)
-      {
-        estimates[i] = ests[i];
-      }
+  const bool converting = est_out != NULL || curve_out != NULL;
+  const bool sweeping = power_caps != NULL;
+  const bool multi_job = job_files != NULL;
+  const bool serving = server_path != NULL;
+  const bool frontier = frontier_file != NULL;
+  if((!converting && !serving && (power_inc <= 0 ||
+                                  (ave_power_per_node <= 0 && !sweeping && !frontier && budget <= 0))) ||
+     (curve_out == NULL && !multi_job && !serving && est_file == NULL && (est_size <= 0 || config == NULL)))
+  {
+    printf(usage, argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return EXIT_FAILURE;
+  }
+  if(sigma < 0 || scenarios <= 0 || percentile < 0 || percentile > 100)
+  {
+    std::cerr<<"Error: robust mode needs sigma >= 0, scenarios > 0 and a percentile in [0, 100]\n";
+    return EXIT_FAILURE;
+  }
+  const bool saving_energy = max_slowdown >= 0;
+  if(saving_energy && (sigma > 0 || group_size > 0 || group_file != NULL))
+  {
+    std::cerr<<"Error: energy mode (-e) works on the flat solve, not with -u, -g or -G\n";
+    return EXIT_FAILURE;
+  }
+  const bool refining = refine_starts > 0;
+  if(refining && (sigma > 0 || saving_energy || refine_budget <= 0))
+  {
+    std::cerr<<"Error: refine mode (-R) needs a budget > 0 and works on min-runtime plans, not with -u or -e\n";
+    return EXIT_FAILURE;
+  }
+  if(use_levels && (sweeping || frontier || multi_job || group_size > 0 || group_file != NULL ||
+                    sigma > 0 || saving_energy))
+  {
+    std::cerr<<"Error: the levels solver works on the flat solve, not with -s, -F, -m, -g, -G, -u or -e\n";
+    return EXIT_FAILURE;
+  }
 
-      Estimator estimator(times, power, size, is_verbose);
+  std::vector<PowerCurve> curves(std::max<size_t>(1, curve_files.size()));
+  if(curve_files.empty())
+  {
+    curves[0].m_power.assign(PP_DEFAULT_POWER, PP_DEFAULT_POWER + PP_DEFAULT_CURVE_SIZE);
+    curves[0].m_times.assign(PP_DEFAULT_TIMES, PP_DEFAULT_TIMES + PP_DEFAULT_CURVE_SIZE);
+  }
+  for(size_t k = 0; k < curve_files.size(); ++k)
+  {
+    if(!curves[k].load(curve_files[k]))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(curve_out != NULL)
+  {
+    return write_curve_binary(curve_out, curves[0]) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  Estimator estimator(&curves[0].m_times[0], &curves[0].m_power[0], curves[0].size(), is_verbose);
+  for(size_t k = 1; k < curves.size(); ++k)
+  {
+    estimator.add_curve(&curves[k].m_times[0], &curves[k].m_power[0], curves[k].size());
+  }
 
-      PowerOptimizer optimizer(estimator, estimates, is_verbose);
-      PowerAllocation alloc = optimizer.optimize(ave_power_per_node, power_inc, is_verbose);
-      alloc.print();
+  for(size_t k = 0; k < sample_files.size(); ++k)
+  {
+    if(static_cast<int>(k) >= estimator.get_num_curves())
+    {
+      std::cerr<<"Error: samples "<<sample_files[k]<<" refine curve class "<<k
+               <<" but only "<<estimator.get_num_curves()<<" curves were given\n";
+      return EXIT_FAILURE;
     }
-    else if(strcmp(config, "B") == 0)
+    PowerCurve measured;
+    if(!measured.load_pairs(sample_files[k]))
     {
-      double ests[est_size] = {0.0984462, 0.136925, 0.0985987, 0.137073, 0.0985987, 0.137073, 0.098704, 0.137221};
-      std::vector<double> estimates(est_size);
-      for(int i = 0; i < est_size; ++i)
-      {
-        estimates[i] = ests[i];
-      }
-
-      Estimator estimator(times, power, size, is_verbose);
+      return EXIT_FAILURE;
+    }
+    std::vector<CurveSample> samples(measured.size());
+    for(int i = 0; i < measured.size(); ++i)
+    {
+      samples[i].m_power = measured.m_power[i];
+      samples[i].m_time = measured.m_times[i];
+    }
+    const int used = samples.empty() ? 0 : estimator.add_samples(&samples[0], measured.size(), k);
+    if(used < 0)
+    {
+      std::cerr<<"Error: samples "<<sample_files[k]<<" need positive runtimes and must not flatten curve class "
+               <<k<<"\n";
+      return EXIT_FAILURE;
+    }
+    if(is_verbose)
+    {
+      std::cout<<"Refined curve "<<k<<" with "<<used<<" of "<<samples.size()<<" samples\n";
+    }
+  }
 
-      PowerOptimizer optimizer(estimator, estimates, is_verbose);
-      PowerAllocation alloc = optimizer.optimize(ave_power_per_node, power_inc, is_verbose);
-      alloc.print();
+  std::vector<int> node_curves;
+  if(class_file != NULL)
+  {
+    EstimateSource classes;
+    if(!classes.load(class_file))
+    {
+      return EXIT_FAILURE;
     }
-    else if(strcmp(config, "C") == 0)
+    node_curves.resize(classes.size());
+    for(size_t i = 0; i < classes.size(); ++i)
     {
-      double ests[est_size] = {0.635545, 0.146498, 0.639121, 0.153703, 0.640393, 0.153808, 0.644058, 0.24526};
-      std::vector<double> estimates(est_size);
-      for(int i = 0; i < est_size; ++i)
+      node_curves[i] = static_cast<int>(classes.data()[i]);
+      if(node_curves[i] < 0 || node_curves[i] >= estimator.get_num_curves())
       {
-        estimates[i] = ests[i];
+        std::cerr<<"Error: node "<<i<<" uses curve class "<<node_curves[i]
+                 <<" but only "<<estimator.get_num_curves()<<" curves were given\n";
+        return EXIT_FAILURE;
       }
+    }
+  }
 
-      Estimator estimator(times, power, size, is_verbose);
+  if(serving)
+  {
+    AllocationServer server(estimator, node_curves);
+    if(est_file != NULL || (est_size > 0 && config != NULL))
+    {
+      EstimateSource source;
+      if(!load_estimates(est_file, data_dir, est_size, config, source))
+      {
+        return EXIT_FAILURE;
+      }
+      server.set_estimates(source.to_vector());
+    }
+    if(strcmp(server_path, "-") == 0)
+    {
+      server.serve(stdin, stdout);
+      return EXIT_SUCCESS;
+    }
+    return server.serve_socket(server_path) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
-      PowerOptimizer optimizer(estimator, estimates, is_verbose);
-      PowerAllocation alloc = optimizer.optimize(ave_power_per_node, power_inc, is_verbose);
-      alloc.print();
+  if(multi_job)
+  {
+    std::vector<std::string> files = split_list(job_files);
+    std::vector<std::string> classes;
+    if(job_classes != NULL)
+    {
+      classes = split_list(job_classes);
+      if(classes.size() != files.size())
+      {
+        std::cerr<<"Error: "<<classes.size()<<" curve classes for "<<files.size()<<" jobs\n";
+        return EXIT_FAILURE;
+      }
     }
-    else if(strcmp(config, "D") == 0)
+    std::vector<SweepConfig> jobs(files.size());
+    size_t total_nodes = 0;
+    for(size_t j = 0; j < files.size(); ++j)
     {
-      double ests[est_size] = {0.123995, 0.15892, 0.124162, 0.159088, 0.124162, 0.159088, 0.124329, 0.159255};
-      std::vector<double> estimates(est_size);
-      for(int i = 0; i < est_size; ++i)
+      EstimateSource source;
+      if(!load_estimates(files[j].c_str(), data_dir, 0, NULL, source))
       {
-        estimates[i] = ests[i];
+        return EXIT_FAILURE;
       }
+      jobs[j].m_name = files[j];
+      jobs[j].m_estimates = source.to_vector();
+      total_nodes += jobs[j].m_estimates.size();
+      if(!classes.empty())
+      {
+        const int curve = atoi(classes[j].c_str());
+        if(curve < 0 || curve >= estimator.get_num_curves())
+        {
+          std::cerr<<"Error: job "<<files[j]<<" uses curve class "<<curve
+                   <<" but only "<<estimator.get_num_curves()<<" curves were given\n";
+          return EXIT_FAILURE;
+        }
+        jobs[j].m_curves.assign(jobs[j].m_estimates.size(), curve);
+      }
+    }
 
-      Estimator estimator(times, power, size, is_verbose);
-
-      PowerOptimizer optimizer(estimator, estimates, is_verbose);
-      PowerAllocation alloc = optimizer.optimize(ave_power_per_node, power_inc, is_verbose);
-      alloc.print();
+    MultiJobAllocator allocator(estimator, jobs, is_verbose);
+    allocator.set_timing(stats_file != NULL);
+    const double total_budget = budget > 0 ? budget : ave_power_per_node * total_nodes;
+    if(total_budget < allocator.get_min_budget())
+    {
+      std::cerr<<"Error: a budget of "<<total_budget<<" W is below the jobs' min power ("
+               <<allocator.get_min_budget()<<" W)\n";
+      return EXIT_FAILURE;
     }
-    else
+    std::vector<JobResult> results = allocator.allocate(total_budget, objective, solver,
+                                                        power_inc, threads, is_verbose);
+    print_jobs(std::cout, jobs, results);
+    if(stats_file != NULL && !write_stats(stats_file, allocator.get_stats()))
     {
-      std::cerr<<"Error: unknown configuration "<<config<<"\n";
-      printf(usage, argv[0]);
       return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
   }
-  else if (est_size == 64)
+
+  std::vector<double> caps;
+  if(power_caps != NULL)
   {
-    if(strcmp(config, "A") == 0)
+    std::vector<std::string> cap_list = split_list(power_caps);
+    for(size_t i = 0; i < cap_list.size(); ++i)
     {
-      double ests[est_size] = {0.0718839, 0.0571076, 0.0571076, 0.0571076, 0.120845, 0.0571076, 0.0571076, 0.0571076, 0.120683, 0.0571076, 0.0571076, 0.0571076, 0.0716591, 0.0571076, 0.0571076, 0.0571076, 0.121076, 0.0571692, 0.0571681, 0.0571076, 0.683754, 0.768937, 0.298057, 0.0571076, 0.684801, 0.778464, 0.315991, 0.0571076, 0.120595, 0.0571076, 0.0571076, 0.0571076, 0.120913, 0.0571706, 0.0571706, 0.0571076, 0.68521, 0.779418, 0.316148, 0.0571076, 0.686265, 0.789161, 0.646493, 0.0571076, 0.120371, 0.0571076, 0.0571076, 0.0571076, 0.0717353, 0.0571076, 0.0571076, 0.0571076, 0.120811, 0.0571692, 0.0571681, 0.0571076, 0.1206, 0.0571706, 0.0571706, 0.0571076, 0.0714823, 0.0571076, 0.0571076, 0.0571076};
-      std::vector<double> estimates(est_size);
-      for(int i = 0; i < est_size; ++i)
-      {
-        estimates[i] = ests[i];
-      }
-
-      Estimator estimator(times, power, size, is_verbose);
+      caps.push_back(atof(cap_list[i].c_str()));
+    }
+  }
 
-      PowerOptimizer optimizer(estimator, estimates, is_verbose);
-      PowerAllocation alloc = optimizer.optimize(ave_power_per_node, power_inc, is_verbose);
-      alloc.print();
+  if(frontier)
+  {
+    EstimateSource source;
+    if(!load_estimates(est_file, data_dir, est_size, config, source))
+    {
+      return EXIT_FAILURE;
     }
-    else if(strcmp(config, "B") == 0)
+    const EstimateView estimates(source.data(), source.size());
+    if(!node_curves.empty() && node_curves.size() != estimates.size())
     {
-      double ests[est_size] = {0.0625158, 0.0642943, 0.0671348, 0.0720748, 0.0622835, 0.0639309, 0.0665318, 0.0710001, 0.0623145, 0.0639871, 0.066577, 0.0710224, 0.0625171, 0.0643098, 0.0671373, 0.0720791, 0.0622835, 0.0639309, 0.0665318, 0.0710001, 0.0620673, 0.0635966, 0.0659821, 0.0700228, 0.0620978, 0.0636386, 0.0660241, 0.0700441, 0.0622846, 0.0639328, 0.0665342, 0.0710043, 0.0623145, 0.0639871, 0.0665769, 0.0710224, 0.0620978, 0.0636386, 0.0660241, 0.0700441, 0.0621285, 0.0636808, 0.0660664, 0.0700655, 0.0623157, 0.0639771, 0.0665793, 0.0710264, 0.0625171, 0.0643098, 0.0671373, 0.0720791, 0.0622846, 0.0639328, 0.0665342, 0.0710043, 0.0623157, 0.063977, 0.0665793, 0.0710264, 0.0625183, 0.0642983, 0.0671399, 0.0720837};
-      std::vector<double> estimates(est_size);
-      for(int i = 0; i < est_size; ++i)
+      std::cerr<<"Error: "<<node_curves.size()<<" curve classes for "
+               <<estimates.size()<<" estimates\n";
+      return EXIT_FAILURE;
+    }
+    PowerOptimizer optimizer(estimator, estimates, node_curves, is_verbose);
+    optimizer.set_quiet(true);
+
+    // the stored caps must be the ones asked for, if any were
+    const uint64_t key = FrontierIndex::make_key(estimator, estimates, node_curves);
+    FrontierIndex index;
+    std::vector<double> sorted_caps = caps;
+    std::sort(sorted_caps.begin(), sorted_caps.end(), std::greater<double>());
+    sorted_caps.erase(std::unique(sorted_caps.begin(), sorted_caps.end()), sorted_caps.end());
+    if(!index.load(frontier_file) || !index.matches(key, estimates.size(), power_inc) ||
+       (!caps.empty() && index.get_caps() != sorted_caps))
+    {
+      if(caps.empty())
       {
-        estimates[i] = ests[i];
+        double hi = 0;
+        double lo = std::numeric_limits<double>::infinity();
+        for(int k = 0; k < estimator.get_num_curves(); ++k)
+        {
+          hi = std::max(hi, estimator.get_max_power(k));
+          lo = std::min(lo, estimator.get_min_power(k));
+        }
+        caps.push_back(hi);
+        for(double cap = std::floor(hi); cap > lo; cap -= 1)
+        {
+          if(cap < hi) caps.push_back(cap);
+        }
+        caps.push_back(lo);
+      }
+      index.build(optimizer, key, caps, power_inc, is_verbose);
+      if(!index.write(frontier_file))
+      {
+        return EXIT_FAILURE;
       }
-
-      Estimator estimator(times, power, size, is_verbose);
-
-      PowerOptimizer optimizer(estimator, estimates, is_verbose);
-      PowerAllocation alloc = optimizer.optimize(ave_power_per_node, power_inc, is_verbose);
-      alloc.print();
     }
-    else if(strcmp(config, "C") == 0)
+
+    if(ave_power_per_node <= 0)
     {
-      double ests[est_size] = {0.0625545, 0.0571076, 0.0571076, 0.0571076, 0.0808647, 0.0571076, 0.0571076, 0.0571076, 0.0807889, 0.0571076, 0.0571076, 0.0571076, 0.0624502, 0.0571076, 0.0571076, 0.0571076, 0.0810187, 0.0571295, 0.0571291, 0.0571076, 0.317146, 0.355104, 0.146498, 0.0571076, 0.317537, 0.358811, 0.153703, 0.0571076, 0.080759, 0.0571076, 0.0571076, 0.0571076, 0.0809423, 0.05713, 0.05713, 0.0571076, 0.317815, 0.359447, 0.153808, 0.0571076, 0.318209, 0.363241, 0.24526, 0.0571076, 0.0806612, 0.0571076, 0.0571076, 0.0571076, 0.062501, 0.0571076, 0.0571076, 0.0571076, 0.0809077, 0.0571295, 0.0571291, 0.0571076, 0.0808143, 0.05713, 0.05713, 0.0571076, 0.0623975, 0.0571076, 0.0571076, 0.0571076};
-      std::vector<double> estimates(est_size);
-      for(int i = 0; i < est_size; ++i)
+      std::vector<SweepConfig> configs(1);
+      configs[0].m_name = config != NULL ? config : est_file;
+      configs[0].m_estimates = source.to_vector();
+      std::vector<SweepPoint> points(index.get_caps().size());
+      for(size_t c = 0; c < points.size(); ++c)
       {
-        estimates[i] = ests[i];
+        points[c].m_config = 0;
+        points[c].m_power = index.get_caps()[c];
+        points[c].m_old_time = index.get_initial_runtimes()[c];
+        points[c].m_paviz_time = index.get_runtimes()[c];
       }
+      print_sweep(std::cout, configs, points);
+      return EXIT_SUCCESS;
+    }
 
-      Estimator estimator(times, power, size, is_verbose);
+    std::vector<double> power;
+    if(!index.lookup(ave_power_per_node, power))
+    {
+      std::cerr<<"Error: "<<ave_power_per_node<<" W is outside the frontier in "<<frontier_file<<"\n";
+      return EXIT_FAILURE;
+    }
+    PowerAllocation alloc = optimizer.start_allocation(ave_power_per_node);
+    alloc.set_power(power);
+    optimizer.greedy_rounds(alloc, power_inc, is_verbose);
+    return write_result(out_file, alloc, format) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
-      PowerOptimizer optimizer(estimator, estimates, is_verbose);
-      PowerAllocation alloc = optimizer.optimize(ave_power_per_node, power_inc, is_verbose);
-      alloc.print();
+  if(power_caps != NULL)
+  {
+    std::vector<std::string> names;
+    if(est_file != NULL)
+    {
+      names.push_back(config != NULL ? config : est_file);
     }
-    else if(strcmp(config, "D") == 0)
+    else
     {
-      double ests[est_size] = {0.0657128, 0.0675463, 0.0699898, 0.073469, 0.0655101, 0.0672622, 0.069611, 0.0729092, 0.0655516, 0.067313, 0.0696602, 0.0729543, 0.0657139, 0.067548, 0.0699918, 0.073471, 0.0655101, 0.0672622, 0.069611, 0.0729092, 0.0653171, 0.0669945, 0.0692542, 0.0723861, 0.0653581, 0.0670439, 0.0693018, 0.0724292, 0.0655112, 0.067264, 0.0696129, 0.0729112, 0.0655516, 0.067313, 0.0696601, 0.0729543, 0.0653581, 0.0670439, 0.0693018, 0.0724292, 0.0653994, 0.0670935, 0.0693495, 0.0724724, 0.0655527, 0.0673148, 0.0696621, 0.0729562, 0.0657139, 0.067548, 0.0699918, 0.073471, 0.0655112, 0.067264, 0.069613, 0.0729112, 0.0655527, 0.0673148, 0.0696621, 0.0729562, 0.065715, 0.0675497, 0.0699939, 0.0734732};
-      std::vector<double> estimates(est_size);
-      for(int i = 0; i < est_size; ++i)
+      names = split_list(config);
+    }
+
+    std::vector<SweepConfig> configs(names.size());
+    for(size_t c = 0; c < names.size(); ++c)
+    {
+      EstimateSource source;
+      if(!load_estimates(est_file, data_dir, est_size, names[c].c_str(), source))
+      {
+        return EXIT_FAILURE;
+      }
+      configs[c].m_name = names[c];
+      configs[c].m_estimates = source.to_vector();
+      configs[c].m_curves = node_curves;
+      if(!node_curves.empty() && node_curves.size() != configs[c].m_estimates.size())
       {
-        estimates[i] = ests[i];
+        std::cerr<<"Error: "<<node_curves.size()<<" curve classes for "
+                 <<configs[c].m_estimates.size()<<" estimates\n";
+        return EXIT_FAILURE;
       }
+    }
+
+    std::vector<SweepPoint> points = run_sweep(estimator, configs, caps, solver, power_inc, threads);
+    print_sweep(std::cout, configs, points);
+    return EXIT_SUCCESS;
+  }
+
+  EstimateSource source;
+  if(!load_estimates(est_file, data_dir, est_size, config, source))
+  {
+    printf(usage, argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if(est_out != NULL)
+  {
+    return write_estimates_binary(est_out, source.data(), source.size()) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // borrowed straight from the source, binary files are not copied
+  const EstimateView estimates(source.data(), source.size());
 
-      Estimator estimator(times, power, size, is_verbose);
+  if(!node_curves.empty() && node_curves.size() != estimates.size())
+  {
+    std::cerr<<"Error: "<<node_curves.size()<<" curve classes for "
+             <<estimates.size()<<" estimates\n";
+    return EXIT_FAILURE;
+  }
 
-      PowerOptimizer optimizer(estimator, estimates, is_verbose);
-      PowerAllocation alloc = optimizer.optimize(ave_power_per_node, power_inc, is_verbose);
-      alloc.print();
+  std::vector<int> node_groups;
+  if(group_file != NULL)
+  {
+    EstimateSource groups;
+    if(!groups.load(group_file))
+    {
+      return EXIT_FAILURE;
     }
-    else
+    if(groups.size() != estimates.size())
     {
-      std::cerr<<"Error: unknown configuration "<<config<<"\n";
-      printf(usage, argv[0]);
+      std::cerr<<"Error: "<<groups.size()<<" groups for "
+               <<estimates.size()<<" estimates\n";
       return EXIT_FAILURE;
     }
+    node_groups.resize(groups.size());
+    for(size_t i = 0; i < groups.size(); ++i)
+    {
+      node_groups[i] = static_cast<int>(groups.data()[i]);
+      if(node_groups[i] < 0)
+      {
+        std::cerr<<"Error: node "<<i<<" has negative group "<<node_groups[i]<<"\n";
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  // only the table shows the starting allocation
+  const bool is_quiet = format != OUTPUT_TABLE || out_file != NULL;
+  PowerOptimizer optimizer(estimator, estimates, node_curves, is_verbose);
+  optimizer.set_timing(stats_file != NULL);
+  optimizer.set_quiet(is_quiet);
+  if(ave_power_per_node * estimates.size() < optimizer.get_min_budget())
+  {
+    std::cerr<<"Error: "<<ave_power_per_node<<" W per node is below the nodes' min power ("
+             <<optimizer.get_min_budget() / estimates.size()<<" W per node)\n";
+    return EXIT_FAILURE;
+  }
+  std::unique_ptr<HierarchicalOptimizer> hierarchy;
+  if(group_size > 0 || group_file != NULL)
+  {
+    hierarchy.reset(new HierarchicalOptimizer(estimator, estimates, node_curves,
+                                              node_groups, group_size, is_verbose));
+    hierarchy->set_timing(stats_file != NULL);
+    hierarchy->set_quiet(is_quiet);
+  }
+  std::unique_ptr<RobustOptimizer> robust;
+  if(sigma > 0)
+  {
+    robust.reset(new RobustOptimizer(optimizer, scenarios, sigma,
+                                     percentile > 0 ? ROBUST_PERCENTILE : ROBUST_MEAN,
+                                     percentile, threads));
+  }
+  std::unique_ptr<EnergyOptimizer> energy;
+  if(saving_energy)
+  {
+    energy.reset(new EnergyOptimizer(optimizer));
+  }
+  // the fixed size kernels and the level tables don't print rounds
+  std::vector<double> fixed_power;
+  int level_rounds = 0;
+  if(use_levels)
+  {
+    level_rounds = solve_levels(estimator, estimates, node_curves, ave_power_per_node, power_inc, fixed_power);
+  }
+  const bool is_fixed = use_levels ||
+                        (!hierarchy && !robust && !energy && solver == GREEDY && curve_files.empty() &&
+                         node_curves.empty() && !is_verbose && stats_file == NULL &&
+                         solve_fixed(estimates, ave_power_per_node, power_inc, fixed_power));
+  PowerAllocation alloc = hierarchy
+    ? hierarchy->optimize(solver, ave_power_per_node, power_inc, threads, is_verbose)
+    : robust
+      ? robust->optimize(solver, ave_power_per_node, power_inc, is_verbose)
+      : energy
+        ? energy->optimize(solver, ave_power_per_node, power_inc, max_slowdown, is_verbose)
+        : is_fixed
+          ? optimizer.start_allocation(ave_power_per_node)
+          : optimizer.solve(solver, ave_power_per_node, power_inc, is_verbose);
+  if(is_fixed)
+  {
+    alloc.set_power(fixed_power);
+    alloc.m_stats.m_rounds += level_rounds;
+  }
+  std::unique_ptr<LocalSearchRefiner> refiner;
+  if(refining)
+  {
+    refiner.reset(new LocalSearchRefiner(optimizer, refine_starts, refine_budget, threads));
+    alloc = refiner->refine(alloc, power_inc, is_verbose);
+  }
+
+  if(!write_result(out_file, alloc, format))
+  {
+    return EXIT_FAILURE;
+  }
+  if(robust && (format == OUTPUT_TABLE || format == OUTPUT_SUMMARY))
+  {
+    print_robust(std::cout, *robust);
+  }
+  if(energy && (format == OUTPUT_TABLE || format == OUTPUT_SUMMARY))
+  {
+    print_energy(std::cout, *energy);
+  }
+  if(refiner && (format == OUTPUT_TABLE || format == OUTPUT_SUMMARY))
+  {
+    print_refine(std::cout, *refiner);
+  }
+
+  if(stats_file != NULL && !write_stats(stats_file, alloc.m_stats))
+  {
+    return EXIT_FAILURE;
   }
+  return EXIT_SUCCESS;
 }
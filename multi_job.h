@@ -0,0 +1,402 @@
+#ifndef multi_job_h
+#define multi_job_h
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+#include <string.h>
+#include <assert.h>
+
+#include "estimator.h"
+#include "thread_pool.h"
+#include "sweep.h"
+
+//
+// What the cluster budget is shared for. A job's slowdown is its
+// runtime over the runtime it would have with every node at its
+// fastest power, which on a curve that is slower at the top than
+// below it is not TDP.
+//
+enum JobObjective
+{
+  MAX_SLOWDOWN,   // the worst job as fast as possible
+  SUM_SLOWDOWN    // the lowest total slowdown over all jobs
+};
+
+struct JobResult
+{
+  double m_budget;
+  double m_best_time;     // every node at its fastest power
+  double m_old_time;      // even split of the cluster budget
+  double m_runtime;       // after solving
+  std::vector<double> m_power;
+
+  double get_slowdown() const
+  {
+    return m_runtime / m_best_time;
+  }
+};
+
+//
+// Several jobs, each a SweepConfig (estimates + curve class per node),
+// under one cluster power budget. Every job is solved by its own
+// PowerOptimizer and the jobs run concurrently on a thread pool. A
+// cross-job pass then moves budget between jobs: each job is re-solved
+// with step watts more and step watts less, and the move from donor to
+// receiver that helps the objective most is kept. step is halved down
+// to power_inc once no move helps.
+//
+class MultiJobAllocator
+{
+protected:
+  struct Outcome
+  {
+    bool m_valid;
+    double m_initial_runtime;
+    double m_runtime;
+    std::vector<double> m_power;
+  };
+
+  struct Job
+  {
+    std::unique_ptr<PowerOptimizer> m_optimizer;
+    double m_min_budget;
+    double m_max_budget;
+    double m_best_time;
+    JobResult m_result;
+    Outcome m_more;         // solved with step more watts
+    Outcome m_less;         // solved with step fewer watts
+    bool m_trials_done;
+    SolverStats m_stats;
+  };
+
+  std::vector<Job> m_jobs;
+  bool m_is_verbose;
+
+  void solve_job(Job &job, const double budget, SolverType solver, double power_inc, Outcome &outcome)
+  {
+    const int nodes = static_cast<int>(job.m_optimizer->get_estimates().size());
+    PowerAllocation alloc = job.m_optimizer->solve(solver, budget / nodes, power_inc, false);
+    outcome.m_valid = true;
+    outcome.m_initial_runtime = alloc.m_initial_runtime;
+    outcome.m_runtime = alloc.get_max_runtime();
+    outcome.m_power = alloc.m_power_values;
+    job.m_stats.add(alloc.m_stats);
+  }
+
+  void run_trials(Job &job, double step, SolverType solver, double power_inc)
+  {
+    const double budget = job.m_result.m_budget;
+    job.m_more.m_valid = false;
+    job.m_less.m_valid = false;
+    if(budget + step <= job.m_max_budget)
+    {
+      solve_job(job, budget + step, solver, power_inc, job.m_more);
+    }
+    if(budget - step >= job.m_min_budget)
+    {
+      solve_job(job, budget - step, solver, power_inc, job.m_less);
+    }
+    job.m_trials_done = true;
+  }
+
+  double slowdown(const Job &job, const double runtime) const
+  {
+    return runtime / job.m_best_time;
+  }
+
+  //
+  // The best (receiver, donor) pair for the objective, false if no move
+  // improves it.
+  //
+  bool pick_move(JobObjective objective, int &receiver, int &donor) const
+  {
+    const int count = static_cast<int>(m_jobs.size());
+    receiver = -1;
+    donor = -1;
+    if(objective == MAX_SLOWDOWN)
+    {
+      // only the slowest job can lower the max
+      int slow = 0;
+      for(int j = 1; j < count; ++j)
+      {
+        if(m_jobs[j].m_result.get_slowdown() > m_jobs[slow].m_result.get_slowdown()) slow = j;
+      }
+      if(!m_jobs[slow].m_more.m_valid) return false;
+      const double raised = slowdown(m_jobs[slow], m_jobs[slow].m_more.m_runtime);
+      double best = m_jobs[slow].m_result.get_slowdown();
+      for(int j = 0; j < count; ++j)
+      {
+        if(j == slow || !m_jobs[j].m_less.m_valid) continue;
+        const double after = std::max(raised, slowdown(m_jobs[j], m_jobs[j].m_less.m_runtime));
+        if(after < best)
+        {
+          best = after;
+          donor = j;
+        }
+      }
+      receiver = slow;
+      return donor != -1;
+    }
+
+    // the pair with the largest drop in the sum
+    double best = 0;
+    for(int r = 0; r < count; ++r)
+    {
+      const Job &to = m_jobs[r];
+      if(!to.m_more.m_valid) continue;
+      const double gain = to.m_result.get_slowdown() - slowdown(to, to.m_more.m_runtime);
+      for(int d = 0; d < count; ++d)
+      {
+        const Job &from = m_jobs[d];
+        if(d == r || !from.m_less.m_valid) continue;
+        const double loss = slowdown(from, from.m_less.m_runtime) - from.m_result.get_slowdown();
+        if(gain - loss > best)
+        {
+          best = gain - loss;
+          receiver = r;
+          donor = d;
+        }
+      }
+    }
+    return receiver != -1;
+  }
+
+  // a job's share of level * total_nodes watts, clamped to what it can use
+  double job_budget(const Job &job, const double level, const size_t total_nodes) const
+  {
+    const size_t nodes = job.m_optimizer->get_estimates().size();
+    return std::max(job.m_min_budget, std::min(job.m_max_budget, level * nodes / total_nodes));
+  }
+
+  //
+  // The cluster wide watts the shares are taken of: total_budget, or
+  // less when jobs clamped up to their min budget would overspend it.
+  // The total is piecewise linear in the level with kinks where a job
+  // hits its min or max budget, as in Estimator::get_even_split_level.
+  //
+  double even_split_level(const double total_budget, const size_t total_nodes) const
+  {
+    std::vector<double> kinks;
+    for(size_t j = 0; j < m_jobs.size(); ++j)
+    {
+      const double scale = static_cast<double>(total_nodes) / m_jobs[j].m_optimizer->get_estimates().size();
+      kinks.push_back(m_jobs[j].m_min_budget * scale);
+      kinks.push_back(m_jobs[j].m_max_budget * scale);
+    }
+    double hi = total_budget;
+    double spent_hi = spent_at(hi, total_nodes);
+    if(spent_hi <= total_budget)
+    {
+      return total_budget;
+    }
+    std::sort(kinks.begin(), kinks.end(), std::greater<double>());
+    for(size_t k = 0; k < kinks.size(); ++k)
+    {
+      const double lo = kinks[k];
+      if(lo >= hi) continue;
+      const double spent_lo = spent_at(lo, total_nodes);
+      if(spent_lo <= total_budget)
+      {
+        return lo + (total_budget - spent_lo) * (hi - lo) / (spent_hi - spent_lo);
+      }
+      hi = lo;
+      spent_hi = spent_lo;
+    }
+    return hi;
+  }
+
+  double spent_at(const double level, const size_t total_nodes) const
+  {
+    double total = 0;
+    for(size_t j = 0; j < m_jobs.size(); ++j)
+    {
+      total += job_budget(m_jobs[j], level, total_nodes);
+    }
+    return total;
+  }
+
+public:
+  MultiJobAllocator(Estimator &e,
+                    const std::vector<SweepConfig> &jobs,
+                    bool verbose)
+    : m_is_verbose(verbose)
+  {
+    m_jobs.resize(jobs.size());
+    for(size_t j = 0; j < jobs.size(); ++j)
+    {
+      Job &job = m_jobs[j];
+      const SweepConfig &config = jobs[j];
+      assert(!config.m_estimates.empty());
+      job.m_optimizer.reset(new PowerOptimizer(e, config.m_estimates, config.m_curves, false));
+      job.m_optimizer->set_quiet(true);
+      job.m_min_budget = 0;
+      job.m_max_budget = 0;
+      job.m_best_time = 0;
+      for(size_t i = 0; i < config.m_estimates.size(); ++i)
+      {
+        const int curve = config.m_curves.empty() ? 0 : config.m_curves[i];
+        job.m_min_budget += e.get_min_power(curve);
+        job.m_max_budget += e.get_max_power(curve);
+        job.m_best_time = std::max(job.m_best_time, e.get_fastest_time(config.m_estimates[i], curve));
+      }
+    }
+  }
+
+  // least cluster budget that runs every node of every job
+  double get_min_budget() const
+  {
+    double total = 0;
+    for(size_t j = 0; j < m_jobs.size(); ++j)
+    {
+      total += m_jobs[j].m_min_budget;
+    }
+    return total;
+  }
+
+  void set_timing(bool timing)
+  {
+    for(size_t j = 0; j < m_jobs.size(); ++j)
+    {
+      m_jobs[j].m_optimizer->set_timing(timing);
+    }
+  }
+
+  // counters of every solve the last allocate() ran, trials included
+  SolverStats get_stats() const
+  {
+    SolverStats stats;
+    for(size_t j = 0; j < m_jobs.size(); ++j)
+    {
+      stats.add(m_jobs[j].m_stats);
+    }
+    return stats;
+  }
+
+  //
+  // Share total_budget watts, at least get_min_budget(). Jobs start
+  // with an even split per node, clamped to what their curves can use;
+  // watts no job can use are left unassigned. Jobs raised to their min
+  // budget are paid for by lowering the split of the others, so the
+  // jobs never get more than total_budget together.
+  //
+  std::vector<JobResult> allocate(double total_budget,
+                                  JobObjective objective,
+                                  SolverType solver,
+                                  double power_inc,
+                                  int threads,
+                                  bool verbose)
+  {
+    const int count = static_cast<int>(m_jobs.size());
+    size_t total_nodes = 0;
+    size_t min_nodes = std::numeric_limits<size_t>::max();
+    double range = 0;
+    for(int j = 0; j < count; ++j)
+    {
+      const size_t nodes = m_jobs[j].m_optimizer->get_estimates().size();
+      total_nodes += nodes;
+      min_nodes = std::min(min_nodes, nodes);
+      range = std::max(range, (m_jobs[j].m_max_budget - m_jobs[j].m_min_budget) / nodes);
+    }
+    assert(total_budget >= get_min_budget());
+    const double level = even_split_level(total_budget, total_nodes);
+    for(int j = 0; j < count; ++j)
+    {
+      Job &job = m_jobs[j];
+      job.m_result.m_budget = job_budget(job, level, total_nodes);
+      job.m_result.m_best_time = job.m_best_time;
+      job.m_trials_done = false;
+      job.m_stats.reset();
+    }
+
+    ThreadPool pool(threads);
+    pool.parallel_for(count, [&](int j)
+    {
+      Job &job = m_jobs[j];
+      Outcome outcome;
+      solve_job(job, job.m_result.m_budget, solver, power_inc, outcome);
+      job.m_result.m_old_time = outcome.m_initial_runtime;
+      job.m_result.m_runtime = outcome.m_runtime;
+      job.m_result.m_power.swap(outcome.m_power);
+    });
+
+    double step = std::max(power_inc, 0.25 * min_nodes * range);
+    int moves = 0;
+    while(count > 1)
+    {
+      pool.parallel_for(count, [&](int j)
+      {
+        if(!m_jobs[j].m_trials_done) run_trials(m_jobs[j], step, solver, power_inc);
+      });
+
+      int receiver = -1;
+      int donor = -1;
+      if(!pick_move(objective, receiver, donor))
+      {
+        if(step <= power_inc) break;
+        step = std::max(power_inc, step / 2);
+        for(int j = 0; j < count; ++j)
+        {
+          m_jobs[j].m_trials_done = false;
+        }
+        continue;
+      }
+
+      Job &to = m_jobs[receiver];
+      Job &from = m_jobs[donor];
+      if(verbose == true)
+      {
+        std::cout<<"---- Move "<<moves<<" ---- "<<step<<" W from job "<<donor<<" to "<<receiver
+                 <<": slowdown "<<from.m_result.get_slowdown()<<" -> "<<slowdown(from, from.m_less.m_runtime)
+                 <<", "<<to.m_result.get_slowdown()<<" -> "<<slowdown(to, to.m_more.m_runtime)<<"\n";
+      }
+      to.m_result.m_budget += step;
+      to.m_result.m_runtime = to.m_more.m_runtime;
+      to.m_result.m_power.swap(to.m_more.m_power);
+      to.m_trials_done = false;
+      from.m_result.m_budget -= step;
+      from.m_result.m_runtime = from.m_less.m_runtime;
+      from.m_result.m_power.swap(from.m_less.m_power);
+      from.m_trials_done = false;
+      moves++;
+    }
+
+    std::vector<JobResult> results(count);
+    for(int j = 0; j < count; ++j)
+    {
+      results[j] = m_jobs[j].m_result;
+    }
+    return results;
+  }
+}; // class MultiJobAllocator
+
+inline bool parse_job_objective(const char *name, JobObjective &objective)
+{
+  if(strcmp(name, "max") == 0) objective = MAX_SLOWDOWN;
+  else if(strcmp(name, "sum") == 0) objective = SUM_SLOWDOWN;
+  else return false;
+  return true;
+}
+
+// one row per job, R-style like print_sweep
+inline void print_jobs(std::ostream &out,
+                       const std::vector<SweepConfig> &jobs,
+                       const std::vector<JobResult> &results)
+{
+  out<<"\"job\" \"n_ests\" \"budget\" \"best_time\" \"old_time\" \"paviz_time\" \"slowdown\"\n";
+  for(size_t j = 0; j < results.size(); ++j)
+  {
+    const JobResult &result = results[j];
+    out<<"\""<<jobs[j].m_name<<"\" "<<jobs[j].m_estimates.size()<<" "
+       <<std::setprecision(15)<<result.m_budget<<" "
+       <<std::setprecision(5)<<result.m_best_time<<" "
+       <<result.m_old_time<<" "<<result.m_runtime<<" "
+       <<result.get_slowdown()<<"\n";
+  }
+}
+
+#endif
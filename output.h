@@ -0,0 +1,96 @@
+#ifndef output_h
+#define output_h
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "estimator.h"
+#include "loader.h"
+
+//
+// Ways to report an allocation. Everything is formatted into one
+// buffer and written with a single call.
+//
+enum OutputFormat
+{
+  OUTPUT_TABLE,    // the human readable Node | Power | Time table
+  OUTPUT_CSV,      // node,power,time,estimate,curve rows
+  OUTPUT_BINARY,   // per-node power caps, PP_CAP_MAGIC header + doubles
+  OUTPUT_SUMMARY   // only the Runtime: lines
+};
+
+inline bool parse_output_format(const char *name, OutputFormat &format)
+{
+  if(strcmp(name, "table") == 0) format = OUTPUT_TABLE;
+  else if(strcmp(name, "csv") == 0) format = OUTPUT_CSV;
+  else if(strcmp(name, "binary") == 0) format = OUTPUT_BINARY;
+  else if(strcmp(name, "summary") == 0) format = OUTPUT_SUMMARY;
+  else return false;
+  return true;
+}
+
+inline void write_csv(std::ostream &out, const PowerAllocation &alloc)
+{
+  const int size = static_cast<int>(alloc.m_times.size());
+  std::string buffer;
+  buffer.reserve(64 * (size + 1));
+  buffer += "node,power,time,estimate,curve\n";
+  char row[128];
+  for(int i = 0; i < size; ++i)
+  {
+    snprintf(row, sizeof(row), "%d,%.17g,%.17g,%.17g,%d\n",
+             i, alloc.m_power_values[i], alloc.m_times[i],
+             alloc.m_orig_estimates[i], alloc.get_curve(i));
+    buffer += row;
+  }
+  out.write(buffer.data(), buffer.size());
+}
+
+// the power cap vector a resource manager can map and apply directly
+inline void write_caps_binary(std::ostream &out, const PowerAllocation &alloc)
+{
+  BinaryHeader header;
+  memcpy(header.magic, PP_CAP_MAGIC, 8);
+  header.count = alloc.m_power_values.size();
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(&alloc.m_power_values[0]),
+            alloc.m_power_values.size() * sizeof(double));
+}
+
+//
+// Runtime of the even split, then of the solved allocation, in the
+// same form as the table footer so existing scripts that grep for
+// Runtime keep working.
+//
+inline void write_summary(std::ostream &out, const PowerAllocation &alloc)
+{
+  char line[128];
+  const int len = snprintf(line, sizeof(line), "Runtime: %.5g\nRuntime: %.5g\n",
+                           alloc.m_initial_runtime, alloc.get_max_runtime());
+  out.write(line, len);
+}
+
+inline void write_allocation(std::ostream &out, const PowerAllocation &alloc, const OutputFormat format)
+{
+  switch(format)
+  {
+    case OUTPUT_CSV:
+      write_csv(out, alloc);
+      break;
+    case OUTPUT_BINARY:
+      write_caps_binary(out, alloc);
+      break;
+    case OUTPUT_SUMMARY:
+      write_summary(out, alloc);
+      break;
+    default:
+      alloc.print(out);
+      break;
+  }
+}
+
+#endif
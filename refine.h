@@ -0,0 +1,291 @@
+#ifndef refine_h
+#define refine_h
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <mutex>
+#include <limits>
+#include <utility>
+#include <iostream>
+#include <assert.h>
+
+#include "estimator.h"
+#include "thread_pool.h"
+
+//
+// Local search after the greedy has converged. The greedy stops once
+// no single power_inc transfer to the bottleneck helps, which leaves
+// two kinds of move untried:
+//   - several steps at once, across a flat stretch of the bottleneck's
+//     curve where one step buys nothing;
+//   - raising a few near tied bottlenecks together, where helping any
+//     one of them alone leaves the max where it was.
+// A move gives the r slowest nodes m * power_inc each, taken power_inc
+// at a time from the best keyed donors, and is kept only if the max
+// runtime drops; the greedy then finishes from there. Power stays on
+// the power_inc lattice of the seed, so the budget is kept exactly.
+//
+// Start 0 refines the seed itself, the others first shake it with
+// random transfers so they can reach other local optima. Starts run
+// on the thread pool, each on its own copy, until they converge or the
+// time budget runs out. The fastest plan wins and ties go to the lower
+// start, so the result only depends on the timing when the budget cuts
+// a start short.
+//
+class LocalSearchRefiner
+{
+protected:
+  typedef std::chrono::steady_clock Clock;
+  // (node, power before the move), restored in reverse
+  typedef std::vector<std::pair<int, double> > Undo;
+
+  PowerOptimizer &m_optimizer;
+  int m_starts;
+  double m_budget_ms;
+  int m_threads;
+  unsigned m_seed;
+  int m_max_nodes;
+  int m_max_steps;
+  double m_seed_runtime;
+  double m_runtime;
+  int m_best_start;
+  int m_starts_run;
+
+  static void undo(PowerAllocation &allocation, const Undo &saved)
+  {
+    for(size_t k = saved.size(); k-- > 0;)
+    {
+      allocation.m_power_values[saved[k].first] = saved[k].second;
+      allocation.update_node(saved[k].first);
+    }
+  }
+
+  static void shift(PowerAllocation &allocation, Undo &saved, const int node, const double amount)
+  {
+    saved.push_back(std::make_pair(node, allocation.m_power_values[node]));
+    allocation.m_power_values[node] += amount;
+    allocation.update_node(node);
+  }
+
+  //
+  // Give each of the `nodes` slowest nodes steps * power_inc, true if
+  // that lowered the max runtime; otherwise the allocation is left as
+  // it was. The donor index must be keyed for power_inc.
+  //
+  static bool try_move(PowerAllocation &allocation, const int nodes, const int steps, const double power_inc)
+  {
+    assert(allocation.m_donor_inc == power_inc);
+    const double before = allocation.get_max_runtime();
+    const double inf = std::numeric_limits<double>::infinity();
+    const int size = static_cast<int>(allocation.m_power_values.size());
+    if(nodes >= size)
+    {
+      return false;
+    }
+
+    // the slowest ones: take the winner and hide it, nodes times
+    std::vector<int> receivers;
+    bool fits = true;
+    for(int k = 0; k < nodes && fits; ++k)
+    {
+      const int node = allocation.get_max_index();
+      receivers.push_back(node);
+      allocation.m_time_index.update(node, -inf);
+      fits = allocation.m_power_values[node] + steps * power_inc <= allocation.get_max_power(node);
+    }
+    if(!fits)
+    {
+      for(size_t k = 0; k < receivers.size(); ++k)
+      {
+        allocation.m_time_index.update(receivers[k], allocation.m_times[receivers[k]]);
+      }
+      return false;
+    }
+
+    Undo saved;
+    for(size_t k = 0; k < receivers.size(); ++k)
+    {
+      shift(allocation, saved, receivers[k], steps * power_inc);
+      // not a donor while it is taking
+      allocation.m_donor_index.update(receivers[k], inf);
+    }
+    bool taken = true;
+    for(int unit = 0; unit < nodes * steps && taken; ++unit)
+    {
+      const int from = allocation.m_donor_index.winner();
+      taken = allocation.m_donor_index.value(from) != inf;
+      if(taken)
+      {
+        shift(allocation, saved, from, -power_inc);
+      }
+    }
+    for(size_t k = 0; k < receivers.size(); ++k)
+    {
+      allocation.m_donor_index.update(receivers[k], allocation.donor_key(receivers[k]));
+    }
+    PP_STAT(allocation.m_stats.m_candidates++);
+    if(taken && allocation.get_max_runtime() < before)
+    {
+      PP_STAT(allocation.m_stats.m_adjustments++);
+      return true;
+    }
+    undo(allocation, saved);
+    return false;
+  }
+
+  // random transfers of 1 to m_max_steps power_inc between any nodes
+  void shake(PowerAllocation &allocation, std::mt19937_64 &rng, const double power_inc) const
+  {
+    const int size = static_cast<int>(allocation.m_power_values.size());
+    std::uniform_int_distribution<int> pick(0, size - 1);
+    std::uniform_int_distribution<int> steps(1, m_max_steps);
+    const int transfers = std::max(2, std::min(size, 64));
+    for(int t = 0; t < transfers; ++t)
+    {
+      const int to = pick(rng);
+      const int from = pick(rng);
+      const double amount = steps(rng) * power_inc;
+      if(to == from ||
+         allocation.m_power_values[to] + amount > allocation.get_max_power(to) ||
+         allocation.m_power_values[from] - amount < allocation.get_min_power(from))
+      {
+        continue;
+      }
+      allocation.m_power_values[to] += amount;
+      allocation.m_power_values[from] -= amount;
+      allocation.update_node(to);
+      allocation.update_node(from);
+    }
+  }
+
+  // greedy, then the smallest improving move and the greedy again,
+  // until no move helps or the deadline. Returns the moves kept.
+  int descend(PowerAllocation &allocation, const double power_inc, const Clock::time_point deadline)
+  {
+    m_optimizer.greedy_rounds(allocation, power_inc, false);
+    int moves = 0;
+    bool progress = true;
+    while(progress && Clock::now() < deadline)
+    {
+      progress = false;
+      {
+        PP_PHASE(allocation.m_stats, m_search_ms);
+        for(int steps = 1; steps <= m_max_steps && !progress; ++steps)
+        {
+          for(int nodes = 1; nodes <= m_max_nodes && !progress; ++nodes)
+          {
+            progress = try_move(allocation, nodes, steps, power_inc);
+          }
+        }
+      }
+      if(progress)
+      {
+        moves++;
+        m_optimizer.greedy_rounds(allocation, power_inc, false);
+      }
+    }
+    return moves;
+  }
+
+public:
+  //
+  // starts allocations refined for at most budget_ms in total, moves
+  // of up to max_steps power_inc to up to max_nodes bottlenecks.
+  //
+  LocalSearchRefiner(PowerOptimizer &optimizer,
+                     const int starts,
+                     const double budget_ms,
+                     const int threads,
+                     const unsigned seed = 1,
+                     const int max_nodes = 4,
+                     const int max_steps = 4)
+    : m_optimizer(optimizer),
+      m_starts(std::max(1, starts)),
+      m_budget_ms(budget_ms),
+      m_threads(threads),
+      m_seed(seed),
+      m_max_nodes(max_nodes),
+      m_max_steps(max_steps),
+      m_seed_runtime(0),
+      m_runtime(0),
+      m_best_start(-1),
+      m_starts_run(0)
+  {
+    assert(max_nodes > 0 && max_steps > 0);
+  }
+
+  // the seed is any allocation over the optimizer's estimates
+  PowerAllocation refine(const PowerAllocation &seed, double power_inc, bool verbose)
+  {
+    const Clock::time_point deadline = Clock::now() +
+      std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(m_budget_ms));
+    PowerAllocation best = seed;
+    m_seed_runtime = seed.get_max_runtime();
+    m_best_start = -1;
+    m_starts_run = 0;
+    std::mutex mutex;
+    ThreadPool pool(m_threads);
+    pool.parallel_for(m_starts, [&](int start)
+    {
+      if(start > 0 && Clock::now() >= deadline)
+      {
+        return;
+      }
+      PowerAllocation allocation = seed;
+      if(start > 0)
+      {
+        std::mt19937_64 rng(m_seed + start);
+        shake(allocation, rng, power_inc);
+      }
+      const int moves = descend(allocation, power_inc, deadline);
+      const double runtime = allocation.get_max_runtime();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      m_starts_run++;
+      if(verbose == true)
+      {
+        std::cout<<"---- Refine start "<<start<<" ---- "<<moves<<" moves: "<<runtime<<"\n";
+      }
+      const double best_runtime = best.get_max_runtime();
+      if(runtime < best_runtime || (runtime == best_runtime && m_best_start != -1 && start < m_best_start))
+      {
+        best = allocation;
+        m_best_start = start;
+      }
+    });
+    m_runtime = best.get_max_runtime();
+    return best;
+  }
+
+  double get_seed_runtime() const
+  {
+    return m_seed_runtime;
+  }
+
+  double get_runtime() const
+  {
+    return m_runtime;
+  }
+
+  // start that produced the result, -1 if none beat the seed
+  int get_best_start() const
+  {
+    return m_best_start;
+  }
+
+  // starts that ran before the time budget was spent
+  int get_starts_run() const
+  {
+    return m_starts_run;
+  }
+}; // class LocalSearchRefiner
+
+// one line after the table or summary, the seed's runtime first
+inline void print_refine(std::ostream &out, const LocalSearchRefiner &refiner)
+{
+  out<<"Refined over "<<refiner.get_starts_run()<<" starts: "<<refiner.get_seed_runtime()
+     <<" -> "<<refiner.get_runtime()<<"\n";
+}
+
+#endif
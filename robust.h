@@ -0,0 +1,357 @@
+#ifndef robust_h
+#define robust_h
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <assert.h>
+
+#include "estimator.h"
+#include "thread_pool.h"
+
+//
+// Perturbed copies of an estimate vector. Every estimate is scaled by
+// its own lognormal factor with mean 1 and relative spread sigma, so
+// a scenario is what the estimates might turn out to be. Stored
+// scenario after scenario, m_nodes doubles each.
+//
+class ScenarioSet
+{
+protected:
+  int m_nodes;
+  int m_count;
+  std::vector<double> m_estimates;
+public:
+  ScenarioSet()
+    : m_nodes(0),
+      m_count(0)
+  {
+  }
+
+  // the same seed gives the same scenarios
+  void generate(const EstimateView &base, const int count, const double sigma, const unsigned seed)
+  {
+    assert(count > 0 && sigma >= 0);
+    m_nodes = static_cast<int>(base.size());
+    m_count = count;
+    m_estimates.resize(static_cast<size_t>(count) * m_nodes);
+    std::mt19937_64 rng(seed);
+    std::normal_distribution<double> normal(-0.5 * sigma * sigma, sigma);
+    for(size_t k = 0; k < m_estimates.size(); ++k)
+    {
+      m_estimates[k] = base[k % m_nodes] * std::exp(normal(rng));
+    }
+  }
+
+  int get_nodes() const
+  {
+    return m_nodes;
+  }
+
+  int get_count() const
+  {
+    return m_count;
+  }
+
+  const double* scenario(const int s) const
+  {
+    return &m_estimates[static_cast<size_t>(s) * m_nodes];
+  }
+}; // class ScenarioSet
+
+enum RobustObjective
+{
+  ROBUST_MEAN,        // expected max runtime over the scenarios
+  ROBUST_PERCENTILE   // a percentile of the max runtime
+};
+
+//
+// Scores allocations against every scenario at once. A node's time
+// is linear in its estimate (Estimator::estimate is orig times a
+// factor that only depends on power and curve), so an allocation
+// reduces to one factor per node and a scenario's runtime is
+// max_i(estimate_i * factor_i): a multiply and max per node, run over
+// blocks of scenarios on the thread pool.
+//
+class ScenarioScorer
+{
+protected:
+  const ScenarioSet &m_scenarios;
+  ThreadPool &m_pool;
+  RobustObjective m_objective;
+  double m_percentile;
+  std::vector<double> m_maxima;
+  std::vector<int> m_bottlenecks;
+
+  static const int BLOCK = 64;
+
+  // max over the nodes of one scenario, four chains so the multiplies
+  // and compares of neighbouring nodes overlap
+  static double scenario_max(const double *estimates,
+                             const double *factors,
+                             const int nodes,
+                             int &bottleneck)
+  {
+    double m[4] = {0, 0, 0, 0};
+    int i = 0;
+    for(; i + 4 <= nodes; i += 4)
+    {
+      for(int k = 0; k < 4; ++k)
+      {
+        const double t = estimates[i + k] * factors[i + k];
+        m[k] = t > m[k] ? t : m[k];
+      }
+    }
+    for(; i < nodes; ++i)
+    {
+      const double t = estimates[i] * factors[i];
+      m[0] = t > m[0] ? t : m[0];
+    }
+    const double result = std::max(std::max(m[0], m[1]), std::max(m[2], m[3]));
+    bottleneck = 0;
+    while(bottleneck < nodes && estimates[bottleneck] * factors[bottleneck] != result) bottleneck++;
+    return result;
+  }
+
+public:
+  // percentile in (0, 100], only used by ROBUST_PERCENTILE
+  ScenarioScorer(const ScenarioSet &scenarios, ThreadPool &pool, RobustObjective objective, double percentile)
+    : m_scenarios(scenarios),
+      m_pool(pool),
+      m_objective(objective),
+      m_percentile(percentile),
+      m_maxima(scenarios.get_count()),
+      m_bottlenecks(scenarios.get_count())
+  {
+  }
+
+  // estimate(power, 1) per node, the factor its estimate is scaled by
+  static void time_factors(const PowerAllocation &allocation, std::vector<double> &factors)
+  {
+    const int size = static_cast<int>(allocation.m_power_values.size());
+    factors.resize(size);
+    for(int i = 0; i < size; ++i)
+    {
+      factors[i] = allocation.m_estimator->estimate(allocation.m_power_values[i], 1.0, allocation.get_curve(i));
+    }
+  }
+
+  //
+  // The objective for per-node factors. Afterwards get_maxima() and
+  // get_bottlenecks() hold each scenario's runtime and slowest node.
+  //
+  double score(const std::vector<double> &factors)
+  {
+    const int nodes = m_scenarios.get_nodes();
+    const int count = m_scenarios.get_count();
+    assert(static_cast<int>(factors.size()) == nodes);
+    const int blocks = (count + BLOCK - 1) / BLOCK;
+    m_pool.parallel_for(blocks, [&](int b)
+    {
+      const int end = std::min(count, (b + 1) * BLOCK);
+      for(int s = b * BLOCK; s < end; ++s)
+      {
+        m_maxima[s] = scenario_max(m_scenarios.scenario(s), &factors[0], nodes, m_bottlenecks[s]);
+      }
+    });
+
+    if(m_objective == ROBUST_MEAN)
+    {
+      double total = 0;
+      for(int s = 0; s < count; ++s)
+      {
+        total += m_maxima[s];
+      }
+      return total / count;
+    }
+    std::vector<double> sorted = m_maxima;
+    const int rank = std::min(count - 1, std::max(0, static_cast<int>(std::ceil(m_percentile / 100.0 * count)) - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+  }
+
+  double score(const PowerAllocation &allocation)
+  {
+    std::vector<double> factors;
+    time_factors(allocation, factors);
+    return score(factors);
+  }
+
+  const std::vector<double>& get_maxima() const
+  {
+    return m_maxima;
+  }
+
+  const std::vector<int>& get_bottlenecks() const
+  {
+    return m_bottlenecks;
+  }
+
+  // the runtime a scenario must reach to count towards the objective
+  double tail_threshold() const
+  {
+    if(m_objective == ROBUST_MEAN) return 0;
+    std::vector<double> sorted = m_maxima;
+    const int count = static_cast<int>(sorted.size());
+    const int rank = std::min(count - 1, std::max(0, static_cast<int>(std::ceil(m_percentile / 100.0 * count)) - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+  }
+}; // class ScenarioScorer
+
+//
+// Robust plan: start from the solver's plan on the point estimates, then move
+// power_inc watts at a time to the node that is most often the
+// bottleneck in the scenarios that set the objective, from whichever
+// of the least critical donors improves the objective most. Each
+// candidate move is scored against every scenario, O(scenarios x N).
+//
+class RobustOptimizer
+{
+protected:
+  PowerOptimizer &m_optimizer;
+  ScenarioSet m_scenarios;
+  RobustObjective m_objective;
+  double m_percentile;
+  int m_threads;
+  double m_point_score;
+  double m_score;
+public:
+  RobustOptimizer(PowerOptimizer &optimizer,
+                  const int scenarios,
+                  const double sigma,
+                  const RobustObjective objective,
+                  const double percentile,
+                  const int threads,
+                  const unsigned seed = 1)
+    : m_optimizer(optimizer),
+      m_objective(objective),
+      m_percentile(percentile),
+      m_threads(threads),
+      m_point_score(0),
+      m_score(0)
+  {
+    m_scenarios.generate(optimizer.get_estimates(), scenarios, sigma, seed);
+  }
+
+  // objective of the plain greedy plan and of the robust plan
+  double get_point_score() const
+  {
+    return m_point_score;
+  }
+
+  double get_score() const
+  {
+    return m_score;
+  }
+
+  int get_scenarios() const
+  {
+    return m_scenarios.get_count();
+  }
+
+  // what the scores are: "mean" or "p<percentile>"
+  void print_objective(std::ostream &out) const
+  {
+    if(m_objective == ROBUST_MEAN) out<<"mean";
+    else out<<"p"<<m_percentile;
+  }
+
+  PowerAllocation optimize(SolverType solver, double ave_power_per_node, double power_inc, bool verbose,
+                           const int donors = 8)
+  {
+    PowerAllocation allocation = m_optimizer.solve(solver, ave_power_per_node, power_inc, false);
+    const int size = static_cast<int>(allocation.m_power_values.size());
+    ThreadPool pool(m_threads);
+    ScenarioScorer scorer(m_scenarios, pool, m_objective, m_percentile);
+
+    std::vector<double> factors;
+    ScenarioScorer::time_factors(allocation, factors);
+    m_point_score = scorer.score(factors);
+    double current = m_point_score;
+
+    std::vector<double> critical(size);
+    std::vector<int> order(size);
+    int round = 0;
+    while(size > 1)
+    {
+      // how often each node sets the runtime of a scenario that counts
+      std::fill(critical.begin(), critical.end(), 0);
+      const double threshold = scorer.tail_threshold();
+      for(int s = 0; s < m_scenarios.get_count(); ++s)
+      {
+        if(scorer.get_maxima()[s] >= threshold) critical[scorer.get_bottlenecks()[s]] += 1;
+      }
+      const int to = static_cast<int>(std::max_element(critical.begin(), critical.end()) - critical.begin());
+      if(allocation.m_power_values[to] + power_inc > allocation.get_max_power(to))
+      {
+        break;
+      }
+
+      for(int i = 0; i < size; ++i) order[i] = i;
+      std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+      {
+        return critical[a] < critical[b] ||
+               (critical[a] == critical[b] && allocation.m_times[a] < allocation.m_times[b]);
+      });
+
+      int best_from = -1;
+      double best = current;
+      std::vector<double> trial = factors;
+      trial[to] = allocation.m_estimator->estimate(allocation.m_power_values[to] + power_inc, 1.0,
+                                                   allocation.get_curve(to));
+      for(int k = 0, tried = 0; k < size && tried < donors; ++k)
+      {
+        const int from = order[k];
+        if(from == to || allocation.m_power_values[from] - power_inc < allocation.get_min_power(from)) continue;
+        tried++;
+        trial[from] = allocation.m_estimator->estimate(allocation.m_power_values[from] - power_inc, 1.0,
+                                                       allocation.get_curve(from));
+        const double value = scorer.score(trial);
+        trial[from] = factors[from];
+        if(value < best)
+        {
+          best = value;
+          best_from = from;
+        }
+      }
+      if(best_from == -1)
+      {
+        break;
+      }
+
+      Adjustment adj;
+      adj.to = to;
+      adj.from = best_from;
+      adj.amount = power_inc;
+      allocation.apply_adjustment(adj);
+      factors[to] = trial[to];
+      factors[best_from] = allocation.m_estimator->estimate(allocation.m_power_values[best_from], 1.0,
+                                                            allocation.get_curve(best_from));
+      if(verbose == true)
+      {
+        std::cout<<"---- Robust round "<<round<<" ---- "<<power_inc<<" W from "<<best_from
+                 <<" to "<<to<<": "<<current<<" -> "<<best<<"\n";
+      }
+      // refresh the maxima and bottlenecks for the next round
+      current = scorer.score(factors);
+      allocation.m_stats.m_rounds++;
+      round++;
+    }
+    m_score = current;
+    return allocation;
+  }
+}; // class RobustOptimizer
+
+// one line after the table or summary, the point plan's score first
+inline void print_robust(std::ostream &out, const RobustOptimizer &robust)
+{
+  out<<"Robust ";
+  robust.print_objective(out);
+  out<<" over "<<robust.get_scenarios()<<" scenarios: "<<robust.get_point_score()
+     <<" -> "<<robust.get_score()<<"\n";
+}
+
+#endif
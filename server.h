@@ -0,0 +1,459 @@
+#ifndef server_h
+#define server_h
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <iostream>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "estimator.h"
+#include "loader.h"
+#include "snapshot.h"
+
+//
+// Long running allocation service. The estimator and the current
+// estimate set stay resident between requests, and the last greedy
+// plan is kept warm so "update" only re-plans what changed (see
+// PowerOptimizer::reoptimize). One request per line, one reply line
+// per request:
+//
+//   set e0 e1 ...           replace the estimates        -> ok <nodes>
+//   load <file>             estimates from a text/binary -> ok <nodes>
+//                           file
+//   update n0 e0 n1 e1 ...  change some estimates        -> ok <changed>
+//   alloc <power> <inc> [greedy|adaptive|water]
+//                           plan at <power> W per node   -> runtime <t> <p0> <p1> ...
+//   sample <power> <time>   refine curve class 0         -> ok <used>
+//   cap <node>              the node's published cap     -> cap <version> <watts>
+//   stats                   counters of the last plan    -> the SolverStats JSON
+//   quit                    end this session             -> bye
+//
+// Failures reply "err <reason>" and change nothing; estimates must be
+// finite and positive. Numbers are separated by spaces or commas.
+// alloc with the same power, inc and the greedy after update returns
+// the warm plan; anything else is solved from the even split.
+//
+// Every new plan (alloc, and update of a warm plan) is published to
+// get_published(), where agent threads of an embedding program can
+// read caps without locking while the server solves (see snapshot.h).
+//
+class AllocationServer
+{
+protected:
+  Estimator &m_estimator;
+  // curve class per node, applies when the node count matches
+  std::vector<int> m_curves;
+  std::vector<double> m_estimates;
+  std::unique_ptr<PowerOptimizer> m_optimizer;
+  // the last plan and what it was asked for
+  std::unique_ptr<PowerAllocation> m_allocation;
+  double m_power;
+  double m_inc;
+  SolverType m_solver;
+  AllocationPublisher m_published;
+  std::string m_reply;
+
+  static bool parse_values(const char *text, std::vector<double> &values)
+  {
+    values.clear();
+    while(*text != '\0')
+    {
+      if(*text == ' ' || *text == ',' || *text == '\t' || *text == '\r' || *text == '\n')
+      {
+        text++;
+        continue;
+      }
+      char *next = NULL;
+      const double val = strtod(text, &next);
+      if(next == text || !std::isfinite(val)) return false;
+      values.push_back(val);
+      text = next;
+    }
+    return true;
+  }
+
+  // a runtime the trees and the curve can order and scale
+  static bool valid_estimate(const double estimate)
+  {
+    return std::isfinite(estimate) && estimate > 0;
+  }
+
+  void drop_plan()
+  {
+    m_allocation.reset();
+    m_optimizer.reset();
+  }
+
+  bool set_estimates(const double *data, const size_t size)
+  {
+    if(size == 0)
+    {
+      m_reply = "err no estimates";
+      return false;
+    }
+    for(size_t i = 0; i < size; ++i)
+    {
+      if(!valid_estimate(data[i]))
+      {
+        m_reply = "err bad estimate";
+        return false;
+      }
+    }
+    m_estimates.assign(data, data + size);
+    drop_plan();
+    reply_ok(size);
+    return true;
+  }
+
+  void reply_ok(const size_t count)
+  {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "ok %zu", count);
+    m_reply = buf;
+  }
+
+  void update(const std::vector<double> &values)
+  {
+    if(values.size() % 2 != 0)
+    {
+      m_reply = "err update needs node, estimate pairs";
+      return;
+    }
+    // every pair is checked before any is applied, a bad one changes nothing
+    std::vector<int> nodes;
+    std::vector<double> estimates;
+    for(size_t i = 0; i < values.size(); i += 2)
+    {
+      const int node = static_cast<int>(values[i]);
+      if(node < 0 || node >= static_cast<int>(m_estimates.size()) || node != values[i])
+      {
+        m_reply = "err bad node";
+        return;
+      }
+      if(!valid_estimate(values[i + 1]))
+      {
+        m_reply = "err bad estimate";
+        return;
+      }
+      nodes.push_back(node);
+      estimates.push_back(values[i + 1]);
+    }
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+      m_estimates[nodes[i]] = estimates[i];
+    }
+    if(m_allocation && m_solver == GREEDY)
+    {
+      m_optimizer->reoptimize(*m_allocation, nodes, estimates, m_inc, false);
+      m_published.publish(*m_allocation);
+    }
+    else
+    {
+      drop_plan();
+    }
+    reply_ok(nodes.size());
+  }
+
+  void allocate(const double power, const double inc, const SolverType solver)
+  {
+    if(m_estimates.empty())
+    {
+      m_reply = "err no estimates";
+      return;
+    }
+    // with curve classes the allocation clamps every node to its curve,
+    // the budget must still cover every node's min power
+    const bool classes = m_curves.size() == m_estimates.size();
+    double min_power = 0;
+    double max_power = 0;
+    for(size_t i = 0; i < m_estimates.size(); ++i)
+    {
+      const int curve = classes ? m_curves[i] : 0;
+      min_power += m_estimator.get_min_power(curve);
+      max_power = std::max(max_power, m_estimator.get_max_power(curve));
+    }
+    // negated so NaN fails them too
+    if(!(inc > 0) || !std::isfinite(inc) || !(power * m_estimates.size() >= min_power) || !(power <= max_power))
+    {
+      m_reply = "err power or increment out of range";
+      return;
+    }
+    const bool warm = m_allocation && solver == GREEDY && m_solver == GREEDY &&
+                      power == m_power && inc == m_inc;
+    if(!warm)
+    {
+      if(!m_optimizer)
+      {
+        // borrows the estimator and m_estimates, nothing is copied
+        m_optimizer.reset(new PowerOptimizer(m_estimator, EstimateView(m_estimates),
+                                             classes ? m_curves : std::vector<int>(), false));
+        m_optimizer->set_quiet(true);
+      }
+      m_allocation.reset(new PowerAllocation(m_optimizer->solve(solver, power, inc, false)));
+      m_published.publish(*m_allocation);
+      m_power = power;
+      m_inc = inc;
+      m_solver = solver;
+    }
+
+    const PowerAllocation &alloc = *m_allocation;
+    char buf[32];
+    m_reply.clear();
+    m_reply.reserve(24 * (alloc.m_power_values.size() + 2));
+    snprintf(buf, sizeof(buf), "runtime %.17g", alloc.get_max_runtime());
+    m_reply += buf;
+    for(size_t i = 0; i < alloc.m_power_values.size(); ++i)
+    {
+      snprintf(buf, sizeof(buf), " %.17g", alloc.m_power_values[i]);
+      m_reply += buf;
+    }
+  }
+
+public:
+  AllocationServer(Estimator &e, const std::vector<int> &curves)
+    : m_estimator(e),
+      m_curves(curves),
+      m_power(0),
+      m_inc(0),
+      m_solver(GREEDY)
+  {
+  }
+
+  void set_estimates(const std::vector<double> &estimates)
+  {
+    m_estimates = estimates;
+    drop_plan();
+  }
+
+  // the plans as they are finished, for readers on other threads
+  const AllocationPublisher& get_published() const
+  {
+    return m_published;
+  }
+
+  //
+  // Answer one request line (without the newline). Returns false for
+  // quit. The reply is valid until the next call.
+  //
+  bool handle(const char *line, const std::string *&reply)
+  {
+    reply = &m_reply;
+    char command[16] = {0};
+    int offset = 0;
+    if(sscanf(line, " %15s%n", command, &offset) != 1)
+    {
+      m_reply = "err empty request";
+      return true;
+    }
+    const char *args = line + offset;
+    std::vector<double> values;
+
+    if(strcmp(command, "quit") == 0)
+    {
+      m_reply = "bye";
+      return false;
+    }
+    if(strcmp(command, "set") == 0)
+    {
+      if(!parse_values(args, values))
+      {
+        m_reply = "err bad number";
+      }
+      else if(!values.empty())
+      {
+        set_estimates(&values[0], values.size());
+      }
+      else
+      {
+        m_reply = "err no estimates";
+      }
+    }
+    else if(strcmp(command, "load") == 0)
+    {
+      char path[4096];
+      EstimateSource source;
+      if(sscanf(args, " %4095s", path) != 1 || !source.load(path))
+      {
+        m_reply = "err cannot load";
+      }
+      else
+      {
+        set_estimates(source.data(), source.size());
+      }
+    }
+    else if(strcmp(command, "update") == 0)
+    {
+      if(!parse_values(args, values))
+      {
+        m_reply = "err bad number";
+      }
+      else
+      {
+        update(values);
+      }
+    }
+    else if(strcmp(command, "alloc") == 0)
+    {
+      double power = 0;
+      double inc = 0;
+      char name[16] = "greedy";
+      SolverType solver = GREEDY;
+      if(sscanf(args, " %lf %lf %15s", &power, &inc, name) < 2)
+      {
+        m_reply = "err alloc needs power and increment";
+      }
+      else if(strcmp(name, "greedy") != 0 && strcmp(name, "adaptive") != 0 && strcmp(name, "water") != 0)
+      {
+        m_reply = "err unknown solver";
+      }
+      else
+      {
+        if(strcmp(name, "adaptive") == 0) solver = ADAPTIVE;
+        if(strcmp(name, "water") == 0) solver = WATER_FILL;
+        allocate(power, inc, solver);
+      }
+    }
+    else if(strcmp(command, "sample") == 0)
+    {
+      CurveSample sample;
+      if(sscanf(args, " %lf %lf", &sample.m_power, &sample.m_time) != 2)
+      {
+        m_reply = "err sample needs power and time";
+      }
+      else
+      {
+        const int used = m_estimator.add_samples(&sample, 1);
+        if(used < 0)
+        {
+          m_reply = "err bad sample";
+        }
+        else
+        {
+          // the warm plan was made on the old curve
+          drop_plan();
+          reply_ok(used);
+        }
+      }
+    }
+    else if(strcmp(command, "cap") == 0)
+    {
+      // read the way an agent thread would
+      int node = -1;
+      const PinnedAllocation pinned(m_published);
+      if(sscanf(args, " %d", &node) != 1 || node < 0 || node >= static_cast<int>(pinned.size()))
+      {
+        m_reply = pinned.version() == 0 ? "err no plan" : "err bad node";
+      }
+      else
+      {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "cap %llu %.17g",
+                 static_cast<unsigned long long>(pinned.version()), pinned.cap(node));
+        m_reply = buf;
+      }
+    }
+    else if(strcmp(command, "stats") == 0)
+    {
+      if(!m_allocation)
+      {
+        m_reply = "err no plan";
+      }
+      else
+      {
+        std::ostringstream out;
+        m_allocation->m_stats.print_json(out);
+        m_reply = out.str();
+        // print_json ends the line itself
+        m_reply.erase(m_reply.find_last_not_of('\n') + 1);
+      }
+    }
+    else
+    {
+      m_reply = "err unknown request";
+    }
+    return true;
+  }
+
+  // serve requests from in until quit or end of file
+  bool serve(FILE *in, FILE *out)
+  {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    bool running = true;
+    while(running && (length = getline(&line, &capacity, in)) != -1)
+    {
+      if(length > 0 && line[length - 1] == '\n') line[length - 1] = '\0';
+      const std::string *reply = NULL;
+      running = handle(line, reply);
+      fwrite(reply->data(), 1, reply->size(), out);
+      fputc('\n', out);
+      fflush(out);
+    }
+    free(line);
+    return running;
+  }
+
+  //
+  // Listen on a Unix domain socket and serve one client at a time,
+  // until a client sends quit.
+  //
+  bool serve_socket(const char *path)
+  {
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener == -1)
+    {
+      std::cerr<<"Error: cannot create socket\n";
+      return false;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+      std::cerr<<"Error: socket path too long "<<path<<"\n";
+      close(listener);
+      return false;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if(bind(listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+       listen(listener, 4) != 0)
+    {
+      std::cerr<<"Error: cannot listen on "<<path<<"\n";
+      close(listener);
+      return false;
+    }
+
+    bool running = true;
+    while(running)
+    {
+      const int fd = accept(listener, NULL, NULL);
+      if(fd == -1) continue;
+      FILE *in = fdopen(fd, "r");
+      FILE *out = fdopen(dup(fd), "w");
+      if(in == NULL || out == NULL)
+      {
+        if(in != NULL) fclose(in); else close(fd);
+        if(out != NULL) fclose(out);
+        continue;
+      }
+      running = serve(in, out);
+      fclose(in);
+      fclose(out);
+    }
+    close(listener);
+    unlink(path);
+    return true;
+  }
+}; // class AllocationServer
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef snapshot_h
+#define snapshot_h
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+#include <assert.h>
+
+#include "estimator.h"
+
+//
+// Publication of finished allocations to reader threads (node agents
+// fetching their cap) while the next one is being solved. The solver
+// keeps mutating its own PowerAllocation and only hands over copies:
+//
+//   writer:  publish(alloc)            one thread at a time
+//   readers: PinnedAllocation pin(publisher);
+//            pin.cap(node), pin.version(), ...
+//
+// There are two slots. Readers pin the current one by bumping its
+// reader count and checking it is still current; they never lock and
+// never wait for a solve. publish() fills the other slot, waiting only
+// for readers still pinning it from two versions ago, then makes it
+// current with one atomic store. Versions start at 1, 0 means nothing
+// was published yet.
+//
+class AllocationPublisher
+{
+protected:
+  // own cache line each, readers of one slot don't slow the other
+  struct alignas(64) Slot
+  {
+    // mutable: pinning is a read of the published state
+    mutable std::atomic<int> m_readers;
+    uint64_t m_version;
+    double m_runtime;
+    std::vector<double> m_power;
+
+    Slot()
+      : m_readers(0),
+        m_version(0),
+        m_runtime(0)
+    {
+    }
+  };
+
+  Slot m_slots[2];
+  std::atomic<int> m_current;
+  uint64_t m_last_version;
+
+  AllocationPublisher(const AllocationPublisher &);
+  AllocationPublisher& operator=(const AllocationPublisher &);
+
+  friend class PinnedAllocation;
+
+  int pin() const
+  {
+    while(true)
+    {
+      const int slot = m_current.load();
+      m_slots[slot].m_readers.fetch_add(1);
+      // the writer may have started refilling it in between
+      if(m_current.load() == slot)
+      {
+        return slot;
+      }
+      m_slots[slot].m_readers.fetch_sub(1);
+    }
+  }
+
+  void unpin(const int slot) const
+  {
+    m_slots[slot].m_readers.fetch_sub(1);
+  }
+
+public:
+  AllocationPublisher()
+    : m_current(0),
+      m_last_version(0)
+  {
+  }
+
+  // returns the new version
+  uint64_t publish(const double *power, const size_t size, const double runtime)
+  {
+    const int next = 1 - m_current.load();
+    Slot &slot = m_slots[next];
+    while(slot.m_readers.load() != 0)
+    {
+      std::this_thread::yield();
+    }
+    slot.m_power.assign(power, power + size);
+    slot.m_runtime = runtime;
+    slot.m_version = ++m_last_version;
+    m_current.store(next);
+    return slot.m_version;
+  }
+
+  uint64_t publish(const PowerAllocation &allocation)
+  {
+    return publish(&allocation.m_power_values[0], allocation.m_power_values.size(),
+                   allocation.get_max_runtime());
+  }
+
+  // last version published, from the writer's side
+  uint64_t get_last_version() const
+  {
+    return m_last_version;
+  }
+}; // class AllocationPublisher
+
+//
+// A reader's view of the current allocation, stable for as long as
+// the object lives. Keep it short lived: publish() waits for it once
+// the slot comes round again.
+//
+class PinnedAllocation
+{
+protected:
+  const AllocationPublisher &m_publisher;
+  const int m_slot;
+
+  PinnedAllocation(const PinnedAllocation &);
+  PinnedAllocation& operator=(const PinnedAllocation &);
+public:
+  explicit PinnedAllocation(const AllocationPublisher &publisher)
+    : m_publisher(publisher),
+      m_slot(publisher.pin())
+  {
+  }
+
+  ~PinnedAllocation()
+  {
+    m_publisher.unpin(m_slot);
+  }
+
+  uint64_t version() const
+  {
+    return m_publisher.m_slots[m_slot].m_version;
+  }
+
+  double runtime() const
+  {
+    return m_publisher.m_slots[m_slot].m_runtime;
+  }
+
+  size_t size() const
+  {
+    return m_publisher.m_slots[m_slot].m_power.size();
+  }
+
+  double cap(const int node) const
+  {
+    assert(node >= 0 && node < static_cast<int>(size()));
+    return m_publisher.m_slots[m_slot].m_power[node];
+  }
+
+  const std::vector<double>& caps() const
+  {
+    return m_publisher.m_slots[m_slot].m_power;
+  }
+}; // class PinnedAllocation
+
+#endif
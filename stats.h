@@ -0,0 +1,126 @@
+#ifndef stats_h
+#define stats_h
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+//
+// Solver statistics. Counters are plain integer increments and are
+// always on unless the build defines POWER_PLAY_STATS=0, which
+// compiles every PP_STAT() statement away. Phase timers read the
+// clock, so they are also switched at runtime with m_timing.
+//
+#ifndef POWER_PLAY_STATS
+#define POWER_PLAY_STATS 1
+#endif
+
+#if POWER_PLAY_STATS
+#define PP_STAT(stmt) stmt
+#else
+#define PP_STAT(stmt)
+#endif
+
+struct SolverStats
+{
+  long long m_estimate_calls;      // forward curve lookups
+  long long m_inverse_calls;       // Estimator::min_power_for_time lookups
+  long long m_rounds;              // solver iterations
+  long long m_candidates;          // transfers scored
+  long long m_rejected_tdp;        // rounds stopped with the bottleneck at TDP
+  long long m_rejected_min_power;  // candidates skipped, donor at min power
+  long long m_adjustments;         // transfers applied
+  double m_init_ms;                // building the allocation and indexes
+  double m_search_ms;              // picking the transfer each round
+  double m_apply_ms;               // applying transfers
+  bool m_timing;
+
+  SolverStats()
+  {
+    reset();
+    m_timing = false;
+  }
+
+  void reset()
+  {
+    m_estimate_calls = 0;
+    m_inverse_calls = 0;
+    m_rounds = 0;
+    m_candidates = 0;
+    m_rejected_tdp = 0;
+    m_rejected_min_power = 0;
+    m_adjustments = 0;
+    m_init_ms = 0;
+    m_search_ms = 0;
+    m_apply_ms = 0;
+  }
+
+  // fold in the counters and phase times of another solve
+  void add(const SolverStats &other)
+  {
+    m_estimate_calls += other.m_estimate_calls;
+    m_inverse_calls += other.m_inverse_calls;
+    m_rounds += other.m_rounds;
+    m_candidates += other.m_candidates;
+    m_rejected_tdp += other.m_rejected_tdp;
+    m_rejected_min_power += other.m_rejected_min_power;
+    m_adjustments += other.m_adjustments;
+    m_init_ms += other.m_init_ms;
+    m_search_ms += other.m_search_ms;
+    m_apply_ms += other.m_apply_ms;
+  }
+
+  void print_json(std::ostream &out) const
+  {
+    out<<"{\"estimate_calls\": "<<m_estimate_calls
+       <<", \"inverse_calls\": "<<m_inverse_calls
+       <<", \"rounds\": "<<m_rounds
+       <<", \"candidates\": "<<m_candidates
+       <<", \"rejected_tdp\": "<<m_rejected_tdp
+       <<", \"rejected_min_power\": "<<m_rejected_min_power
+       <<", \"adjustments\": "<<m_adjustments
+       <<", \"timing\": "<<(m_timing ? "true" : "false")
+       <<std::setprecision(6)
+       <<", \"init_ms\": "<<m_init_ms
+       <<", \"search_ms\": "<<m_search_ms
+       <<", \"apply_ms\": "<<m_apply_ms
+       <<"}\n";
+  }
+}; // struct SolverStats
+
+//
+// Adds the time spent in its scope to a phase total, does nothing
+// unless enabled.
+//
+class PhaseTimer
+{
+protected:
+  double *m_total;
+  std::chrono::steady_clock::time_point m_start;
+public:
+  PhaseTimer(const bool enabled, double &total)
+    : m_total(enabled ? &total : NULL)
+  {
+    if(m_total != NULL)
+    {
+      m_start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~PhaseTimer()
+  {
+    if(m_total != NULL)
+    {
+      *m_total += std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - m_start).count();
+    }
+  }
+}; // class PhaseTimer
+
+#if POWER_PLAY_STATS
+#define PP_PHASE(stats, phase) PhaseTimer pp_phase_timer((stats).m_timing, (stats).phase)
+#else
+#define PP_PHASE(stats, phase)
+#endif
+
+#endif
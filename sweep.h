@@ -0,0 +1,101 @@
+#ifndef sweep_h
+#define sweep_h
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+
+#include "estimator.h"
+#include "thread_pool.h"
+
+//
+// One estimate set to sweep over, e.g. config "A" of the 64 node runs
+//
+struct SweepConfig
+{
+  std::string m_name;
+  std::vector<double> m_estimates;
+  // curve class per node, empty for all class 0
+  std::vector<int> m_curves;
+};
+
+struct SweepPoint
+{
+  int m_config;
+  double m_power;
+  double m_old_time;
+  double m_paviz_time;
+};
+
+//
+// Times are reported with 5 significant digits, the same as the
+// "Runtime:" line, and the speedup is computed from the reported
+// values, so the tables match the checked in 8nodes.tmp and 64nodes.tmp.
+//
+inline double round_runtime(const double value)
+{
+  std::ostringstream str;
+  str<<std::setprecision(5)<<value;
+  return atof(str.str().c_str());
+}
+
+//
+// Solve every (config, power cap) pair on a thread pool. All points
+// of a config share one optimizer, and so one estimator and one copy
+// of the estimates. Rows come back in config-major, cap order.
+//
+inline std::vector<SweepPoint> run_sweep(Estimator &estimator,
+                                         const std::vector<SweepConfig> &configs,
+                                         const std::vector<double> &power_caps,
+                                         const SolverType solver,
+                                         const double power_inc,
+                                         const int threads)
+{
+  std::vector<std::unique_ptr<PowerOptimizer> > optimizers(configs.size());
+  for(size_t c = 0; c < configs.size(); ++c)
+  {
+    optimizers[c].reset(new PowerOptimizer(estimator, configs[c].m_estimates, configs[c].m_curves, false));
+    optimizers[c]->set_quiet(true);
+  }
+
+  const int caps = static_cast<int>(power_caps.size());
+  const int count = static_cast<int>(configs.size()) * caps;
+  std::vector<SweepPoint> points(count);
+
+  ThreadPool pool(threads);
+  pool.parallel_for(count, [&](int i)
+  {
+    SweepPoint &point = points[i];
+    point.m_config = i / caps;
+    point.m_power = power_caps[i % caps];
+    PowerAllocation alloc = optimizers[point.m_config]->solve(solver, point.m_power, power_inc, false);
+    point.m_old_time = alloc.m_initial_runtime;
+    point.m_paviz_time = alloc.get_max_runtime();
+  });
+  return points;
+}
+
+// same layout as the checked in 8nodes.tmp and 64nodes.tmp
+inline void print_sweep(std::ostream &out,
+                        const std::vector<SweepConfig> &configs,
+                        const std::vector<SweepPoint> &points)
+{
+  out<<"\"n_ests\" \"conf\" \"pow\" \"old_time\" \"paviz_time\" \"speedup\"\n";
+  for(size_t i = 0; i < points.size(); ++i)
+  {
+    const SweepPoint &point = points[i];
+    const SweepConfig &config = configs[point.m_config];
+    const double old_time = round_runtime(point.m_old_time);
+    const double paviz_time = round_runtime(point.m_paviz_time);
+    out<<config.m_estimates.size()<<" \""<<config.m_name<<"\" "
+       <<std::setprecision(15)<<point.m_power<<" "
+       <<old_time<<" "<<paviz_time<<" "
+       <<old_time / paviz_time<<"\n";
+  }
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef thread_pool_h
+#define thread_pool_h
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <assert.h>
+
+//
+// Fixed set of worker threads pulling tasks off one queue.
+// A pool of size 1 (or 0) runs everything on the calling thread
+// inside wait(), which keeps serial runs free of threading.
+//
+class ThreadPool
+{
+protected:
+  std::vector<std::thread> m_workers;
+  std::deque<std::function<void()> > m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_task_ready;
+  std::condition_variable m_all_done;
+  int m_running;
+  bool m_stop;
+
+  void worker_loop()
+  {
+    while(true)
+    {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_task_ready.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+        if(m_stop && m_tasks.empty()) return;
+        task = m_tasks.front();
+        m_tasks.pop_front();
+        m_running++;
+      }
+      task();
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_running--;
+        if(m_running == 0 && m_tasks.empty())
+        {
+          m_all_done.notify_all();
+        }
+      }
+    }
+  }
+
+  ThreadPool(const ThreadPool &);
+  ThreadPool& operator=(const ThreadPool &);
+public:
+  // threads <= 0 picks the number of hardware threads
+  explicit ThreadPool(int threads)
+    : m_running(0),
+      m_stop(false)
+  {
+    if(threads <= 0)
+    {
+      threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    if(threads > 1)
+    {
+      for(int i = 0; i < threads; ++i)
+      {
+        m_workers.push_back(std::thread(&ThreadPool::worker_loop, this));
+      }
+    }
+  }
+
+  ~ThreadPool()
+  {
+    wait();
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_task_ready.notify_all();
+    for(size_t i = 0; i < m_workers.size(); ++i)
+    {
+      m_workers[i].join();
+    }
+  }
+
+  int size() const
+  {
+    return m_workers.empty() ? 1 : static_cast<int>(m_workers.size());
+  }
+
+  void submit(const std::function<void()> &task)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_tasks.push_back(task);
+    }
+    m_task_ready.notify_one();
+  }
+
+  // block until every submitted task has finished
+  void wait()
+  {
+    if(m_workers.empty())
+    {
+      while(!m_tasks.empty())
+      {
+        std::function<void()> task = m_tasks.front();
+        m_tasks.pop_front();
+        task();
+      }
+      return;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_all_done.wait(lock, [this] { return m_running == 0 && m_tasks.empty(); });
+  }
+
+  // run body(i) for i in [0, count) and wait for all of them
+  void parallel_for(const int count, const std::function<void(int)> &body)
+  {
+    std::atomic<int> next(0);
+    const int chunks = std::min(count, size());
+    for(int c = 0; c < chunks; ++c)
+    {
+      submit([&next, count, &body]
+      {
+        int i;
+        while((i = next.fetch_add(1)) < count)
+        {
+          body(i);
+        }
+      });
+    }
+    wait();
+  }
+}; // class ThreadPool
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef tournament_tree_h
+#define tournament_tree_h
+
+#include <vector>
+#include <assert.h>
+#include <functional>
+#include <algorithm>
+
+//
+// Complete binary tree of "matches" over a fixed set of values.
+// Each internal node stores the index of the winning leaf below it,
+// so the overall winner is available in O(1) and a value change is
+// O(log N). Ties always go to the lower index, which keeps results
+// identical to a left-to-right linear scan.
+//
+// Compare(a, b) == true means a beats b, so std::greater<double>
+// gives a max tree and std::less<double> gives a min tree.
+//
+template<typename Compare>
+class TournamentTree
+{
+protected:
+  int m_size;
+  int m_leaves;
+  std::vector<double> m_values;
+  std::vector<int> m_winners;
+  Compare m_comp;
+
+  int play(const int a, const int b) const
+  {
+    if(a == -1) return b;
+    if(b == -1) return a;
+    // on a tie the left (lower index) side wins
+    if(m_comp(m_values[b], m_values[a])) return b;
+    return a;
+  }
+
+  int range_winner(const int node,
+                   const int node_lo,
+                   const int node_hi,
+                   const int lo,
+                   const int hi) const
+  {
+    if(hi <= node_lo || node_hi <= lo) return -1;
+    if(lo <= node_lo && node_hi <= hi) return m_winners[node];
+    const int mid = (node_lo + node_hi) / 2;
+    return play(range_winner(2 * node, node_lo, mid, lo, hi),
+                range_winner(2 * node + 1, mid, node_hi, lo, hi));
+  }
+
+  int first_within(const int node,
+                   const int node_lo,
+                   const int node_hi,
+                   const int lo,
+                   const int hi,
+                   const double bound) const
+  {
+    if(hi <= node_lo || node_hi <= lo) return -1;
+    const int winner = m_winners[node];
+    // nothing in this subtree is at least as good as the bound
+    if(winner == -1 || m_comp(bound, m_values[winner])) return -1;
+    if(node_hi - node_lo == 1) return winner;
+    const int mid = (node_lo + node_hi) / 2;
+    int res = first_within(2 * node, node_lo, mid, lo, hi, bound);
+    if(res != -1) return res;
+    return first_within(2 * node + 1, mid, node_hi, lo, hi, bound);
+  }
+
+public:
+  TournamentTree()
+    : m_size(0),
+      m_leaves(1),
+      m_winners(2, -1)
+  {
+  }
+
+  explicit TournamentTree(const std::vector<double> &values)
+  {
+    build(values);
+  }
+
+  void build(const std::vector<double> &values)
+  {
+    m_size = static_cast<int>(values.size());
+    m_values = values;
+    m_leaves = 1;
+    while(m_leaves < m_size) m_leaves *= 2;
+    m_winners.assign(2 * m_leaves, -1);
+    for(int i = 0; i < m_size; ++i)
+    {
+      m_winners[m_leaves + i] = i;
+    }
+    for(int node = m_leaves - 1; node > 0; --node)
+    {
+      m_winners[node] = play(m_winners[2 * node], m_winners[2 * node + 1]);
+    }
+  }
+
+  int size() const
+  {
+    return m_size;
+  }
+
+  double value(const int index) const
+  {
+    return m_values[index];
+  }
+
+  const std::vector<double>& values() const
+  {
+    return m_values;
+  }
+
+  void update(const int index, const double value)
+  {
+    assert(index >= 0 && index < m_size);
+    m_values[index] = value;
+    int node = (m_leaves + index) / 2;
+    while(node > 0)
+    {
+      m_winners[node] = play(m_winners[2 * node], m_winners[2 * node + 1]);
+      node /= 2;
+    }
+  }
+
+  // index of the best value, -1 if empty
+  int winner() const
+  {
+    return m_winners[1];
+  }
+
+  // best index in [lo, hi), -1 if the range is empty
+  int winner(const int lo, const int hi) const
+  {
+    return range_winner(1, 0, m_leaves, lo, hi);
+  }
+
+  // best index ignoring up to two entries (pass -1 to not skip)
+  int winner_excluding(int skip_a, int skip_b) const
+  {
+    if(skip_a > skip_b) std::swap(skip_a, skip_b);
+    if(skip_a == -1) skip_a = skip_b;
+    if(skip_b == -1) return winner();
+    if(skip_a == skip_b)
+    {
+      return play(winner(0, skip_a), winner(skip_a + 1, m_size));
+    }
+    int res = winner(0, skip_a);
+    res = play(res, winner(skip_a + 1, skip_b));
+    return play(res, winner(skip_b + 1, m_size));
+  }
+
+  //
+  // lowest index in [lo, hi) whose value is at least as good as bound,
+  // i.e. value <= bound for a min tree, -1 if there is none
+  //
+  int first_within(const int lo, const int hi, const double bound) const
+  {
+    return first_within(1, 0, m_leaves, lo, hi, bound);
+  }
+
+  int first_within_excluding(int skip_a, int skip_b, const double bound) const
+  {
+    if(skip_a > skip_b) std::swap(skip_a, skip_b);
+    if(skip_a == -1) skip_a = skip_b;
+    if(skip_b == -1) return first_within(0, m_size, bound);
+    int res = first_within(0, skip_a, bound);
+    if(res != -1) return res;
+    if(skip_a != skip_b)
+    {
+      res = first_within(skip_a + 1, skip_b, bound);
+      if(res != -1) return res;
+    }
+    return first_within(skip_b + 1, m_size, bound);
+  }
+}; // class TournamentTree
+
+typedef TournamentTree<std::greater<double> > MaxTree;
+typedef TournamentTree<std::less<double> > MinTree;
+
+#endif